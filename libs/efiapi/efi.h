@@ -108,6 +108,12 @@ typedef enum {
   EFI_ALLOCATE_TYPE_MAX
 } efi_allocate_type_t;
 
+// Page size used by the page allocation services
+#define EFI_PAGE_SIZE   4096
+#define EFI_PAGE_SHIFT  12
+#define EFI_SIZE_TO_PAGES(size) \
+  (((size) >> EFI_PAGE_SHIFT) + (((size) & (EFI_PAGE_SIZE - 1)) ? 1 : 0))
+
 // Memory type
 typedef enum {
   EFI_RESERVED_MEMORY_TYPE,
@@ -172,6 +178,26 @@ typedef struct efi_system_table efi_system_table_t;
 #define EFI_ACPI_TABLE_GUID \
   { 0x8868e871, 0xe4f1, 0x11d3, { 0xbc, 0x22, 0x00, 0x80, 0xc7, 0x3c, 0x88, 0x81 } }
 
+#define EFI_ACPI_20_TABLE_GUID EFI_ACPI_TABLE_GUID
+
+#define EFI_ACPI_10_TABLE_GUID \
+  { 0xeb9d2d30, 0x2d88, 0x11d3, { 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } }
+
+#define EFI_SMBIOS_TABLE_GUID \
+  { 0xeb9d2d31, 0x2d88, 0x11d3, { 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } }
+
+#define EFI_SMBIOS3_TABLE_GUID \
+  { 0xf2fd1544, 0x9794, 0x4a2c, { 0x99, 0x2e, 0xe5, 0xbb, 0xcf, 0x20, 0xe3, 0x94 } }
+
+#define EFI_MPS_TABLE_GUID \
+  { 0xeb9d2d2f, 0x2d88, 0x11d3, { 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } }
+
+#define EFI_DTB_TABLE_GUID \
+  { 0xb1b621d5, 0xf19c, 0x41a5, { 0x83, 0x0b, 0xd9, 0x15, 0x2c, 0x69, 0xaa, 0xe0 } }
+
+#define EFI_MEMORY_ATTRIBUTES_TABLE_GUID \
+  { 0xdcfa911d, 0x26eb, 0x469f, { 0xa2, 0x20, 0x38, 0xb7, 0xdc, 0x46, 0x12, 0x20 } }
+
 
 #define EFI_SYSTEM_TABLE_SIGNATURE      0x5453595320494249
 #define EFI_BOOT_SERVICES_SIGNATURE     0x56524553544f4f42
@@ -352,6 +378,11 @@ typedef struct {
     efi_event_t *event);
 } efi_boot_services_t;
 
+// Variable attributes
+#define EFI_VARIABLE_NON_VOLATILE        0x00000001
+#define EFI_VARIABLE_BOOTSERVICE_ACCESS  0x00000002
+#define EFI_VARIABLE_RUNTIME_ACCESS      0x00000004
+
 // Types of resets
 typedef enum {
   EFI_RESET_COLD,
@@ -75,12 +75,125 @@ typedef struct {
 
 #define EFI_ACPI_DEVICE_PATH                  0x02
 
+/* ACPI Device Path Sub-type */
+#define EFI_ACPI_ACPI_DEVICE_PATH             0x01
+
+/* EISA ID of PNP devices, as stored in hid */
+#define EFI_PNP_ID(id)                        (((id) << 16) | 0x41d0)
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u32_t hid;
+  efi_u32_t uid;
+} efi_acpi_device_path_t;
+
+/* ACPI _ADR Device Path Sub-type */
+#define EFI_ACPI_ADR_DEVICE_PATH              0x03
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u32_t adr;
+} efi_acpi_adr_device_path_t;
+
 //
 // Messaging Device Path
 //
 
 #define EFI_MESSAGING_DEVICE_PATH             0x03
 
+/* SCSI Device Path Sub-type */
+#define EFI_MESSAGING_SCSI_DEVICE_PATH        0x02
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u16_t target_id;
+  efi_u16_t lun;
+} efi_scsi_device_path_t;
+
+/* USB Device Path Sub-type */
+#define EFI_MESSAGING_USB_DEVICE_PATH         0x05
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u8_t parent_port;
+  efi_u8_t interface;
+} efi_usb_device_path_t;
+
+/* Vendor-specific Device Path Sub-type */
+#define EFI_MESSAGING_VENDOR_DEVICE_PATH      0x0a
+
+/* MAC Address Device Path Sub-type */
+#define EFI_MESSAGING_MAC_DEVICE_PATH         0x0b
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u8_t mac_address[32];
+  efi_u8_t if_type;
+} efi_mac_device_path_t;
+
+/* IPv4 Device Path Sub-type */
+#define EFI_MESSAGING_IPV4_DEVICE_PATH        0x0c
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u8_t local_address[4];
+  efi_u8_t remote_address[4];
+  efi_u16_t local_port;
+  efi_u16_t remote_port;
+  efi_u16_t protocol;
+  efi_u8_t static_address;
+  efi_u8_t gateway_address[4];
+  efi_u8_t subnet_mask[4];
+} __attribute__((packed)) efi_ipv4_device_path_t;
+
+/* UART Device Path Sub-type */
+#define EFI_MESSAGING_UART_DEVICE_PATH        0x0e
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u32_t reserved;
+  efi_u64_t baud_rate;
+  efi_u8_t data_bits;
+  efi_u8_t parity;
+  efi_u8_t stop_bits;
+} __attribute__((packed)) efi_uart_device_path_t;
+
+/* SATA Device Path Sub-type */
+#define EFI_MESSAGING_SATA_DEVICE_PATH        0x12
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u16_t hba_port;
+  efi_u16_t port_multiplier_port;
+  efi_u16_t lun;
+} efi_sata_device_path_t;
+
+/* NVMe Namespace Device Path Sub-type */
+#define EFI_MESSAGING_NVME_DEVICE_PATH        0x17
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u32_t namespace_id;
+  efi_u8_t eui64[8];
+} efi_nvme_device_path_t;
+
+/* URI Device Path Sub-type */
+#define EFI_MESSAGING_URI_DEVICE_PATH         0x18
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  char uri[];
+} efi_uri_device_path_t;
+
+/* SD and eMMC Device Path Sub-types */
+#define EFI_MESSAGING_SD_DEVICE_PATH          0x1a
+#define EFI_MESSAGING_EMMC_DEVICE_PATH        0x1d
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u8_t slot_number;
+} efi_sd_device_path_t;
+
 //
 // Media Device Path
 //
@@ -105,7 +218,7 @@ typedef struct {
   efi_u8_t signature[16];
   efi_u8_t mbr_type;
   efi_u8_t signature_type;
-} efi_harddrive_device_path_t;
+} __attribute__((packed)) efi_harddrive_device_path_t;
 
 /* CD-ROM Device Path Sub-type */
 #define EFI_MEDIA_CDROM_DEVICE_PATH           0x02
@@ -136,6 +249,41 @@ typedef struct {
   efi_guid_t protocol;
 } efi_media_protocol_device_path_t;
 
+/* PI Firmware File and Firmware Volume Device Path Sub-types */
+#define EFI_MEDIA_FV_FILE_DEVICE_PATH         0x06
+#define EFI_MEDIA_FV_DEVICE_PATH              0x07
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_guid_t name;
+} efi_fv_device_path_t;
+
+/* Relative Offset Range Device Path Sub-type */
+#define EFI_MEDIA_OFFSET_DEVICE_PATH          0x08
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u32_t reserved;
+  efi_u64_t start_offset;
+  efi_u64_t end_offset;
+} efi_offset_device_path_t;
+
+//
+// BIOS Boot Specification Device Path
+//
+
+#define EFI_BBS_DEVICE_PATH                   0x05
+
+/* BBS 1.01 Device Path Sub-type */
+#define EFI_BBS_BBS_DEVICE_PATH               0x01
+
+typedef struct {
+  efi_device_path_protocol_t header;
+  efi_u16_t device_type;
+  efi_u16_t status_flag;
+  char description[];
+} efi_bbs_device_path_t;
+
 //
 // End of Device Path
 //
@@ -0,0 +1,171 @@
+/*
+ * ACPI table index
+ */
+#include <efi.h>
+#include <efiutil.h>
+
+/*
+ * Storage is static, so nothing needs allocating and lookups keep working
+ * after exit_boot_services. Tables sharing a signature are chained through
+ * next in the order they appear in the XSDT.
+ */
+#define MAX_TABLES	256
+#define NUM_SLOTS	(2 * MAX_TABLES)
+#define NO_TABLE	0xffff
+
+struct table {
+	efi_u32_t signature;
+	efi_u16_t next;
+	efi_u16_t count;		/* Instances in the chain, kept on the first */
+	efi_acpi_header_t *header;
+};
+
+static efi_acpi_rsdp_t *rsdp;
+static struct table tables[MAX_TABLES];
+static efi_size_t num_tables;
+static efi_u16_t slots[NUM_SLOTS];	/* First table of a signature + 1 */
+static efi_status_t init_status = EFI_NOT_STARTED;
+
+static efi_u8_t checksum(void *data, efi_size_t len)
+{
+	efi_u8_t sum = 0;
+
+	for (efi_size_t i = 0; i < len; ++i)
+		sum += ((efi_u8_t *) data)[i];
+	return sum;
+}
+
+static efi_size_t slot_of(efi_u32_t signature)
+{
+	efi_size_t i;
+
+	for (i = ((signature * 0x9e3779b1) >> 16) % NUM_SLOTS; slots[i];
+			i = (i + 1) % NUM_SLOTS)
+		if (tables[slots[i] - 1].signature == signature)
+			break;
+	return i;
+}
+
+static void add_table(efi_u64_t addr)
+{
+	efi_acpi_header_t *header;
+	struct table *t;
+	efi_size_t slot;
+
+	/* A table out of reach on ia32 is as good as missing */
+	if (!addr || addr != (efi_uptr_t) addr || num_tables == MAX_TABLES)
+		return;
+	header = (efi_acpi_header_t *) (efi_uptr_t) addr;
+
+	t = &tables[num_tables];
+	memcpy(&t->signature, header->signature, sizeof(t->signature));
+	t->header = header;
+	t->next = NO_TABLE;
+	t->count = 1;
+
+	slot = slot_of(t->signature);
+	if (slots[slot]) {
+		struct table *first = &tables[slots[slot] - 1], *last;
+		for (last = first; last->next != NO_TABLE; last = &tables[last->next])
+			;
+		last->next = num_tables;
+		++first->count;
+	} else {
+		slots[slot] = num_tables + 1;
+	}
+	++num_tables;
+}
+
+/* The DSDT and FACS are only referenced from the FADT */
+static void add_fadt_tables(efi_acpi_fadt_t *fadt)
+{
+	efi_u64_t addr;
+
+	/* The 64-bit pointers only exist in ACPI 2.0 and later FADTs */
+	addr = fadt->header.length >= sizeof(*fadt) ? fadt->x_dsdt : 0;
+	add_table(addr ? addr : fadt->dsdt);
+	addr = fadt->header.length >= sizeof(*fadt) ? fadt->x_firmware_ctrl : 0;
+	add_table(addr ? addr : fadt->firmware_ctrl);
+}
+
+efi_status_t efi_acpi_init(void)
+{
+	efi_acpi_header_t *sdt;
+	efi_acpi_fadt_t *fadt;
+	efi_size_t entry_size, num_entries;
+	efi_u8_t *entries;
+
+	if (init_status != EFI_NOT_STARTED)
+		return init_status;
+	init_status = EFI_NOT_FOUND;
+
+	rsdp = efi_acpi_rsdp();
+	if (!rsdp)
+		return init_status;
+
+	/* Only ACPI 2.0 and later have the XSDT and the extended checksum */
+	init_status = EFI_CRC_ERROR;
+	if (memcmp(rsdp->signature, "RSD PTR ", sizeof(rsdp->signature))
+			|| checksum(rsdp, EFI_ACPI_RSDP_V1_SIZE))
+		return init_status;
+	if (rsdp->revision >= 2 && rsdp->xsdt_address
+			&& rsdp->xsdt_address == (efi_uptr_t) rsdp->xsdt_address) {
+		if (checksum(rsdp, rsdp->length))
+			return init_status;
+		sdt = (efi_acpi_header_t *) (efi_uptr_t) rsdp->xsdt_address;
+		entry_size = sizeof(efi_u64_t);
+	} else {
+		sdt = (efi_acpi_header_t *) (efi_uptr_t) rsdp->rsdt_address;
+		entry_size = sizeof(efi_u32_t);
+	}
+	if (!sdt || checksum(sdt, sdt->length))
+		return init_status;
+
+	/* Entries are not naturally aligned in the XSDT */
+	entries = (efi_u8_t *) (sdt + 1);
+	num_entries = (sdt->length - sizeof(*sdt)) / entry_size;
+	for (efi_size_t i = 0; i < num_entries; ++i) {
+		efi_u64_t addr = 0;
+		memcpy(&addr, entries + i * entry_size, entry_size);
+		add_table(addr);
+	}
+
+	fadt = (efi_acpi_fadt_t *) efi_acpi_table(EFI_ACPI_SIG_FADT, 0);
+	if (fadt)
+		add_fadt_tables(fadt);
+
+	init_status = EFI_SUCCESS;
+	return init_status;
+}
+
+efi_acpi_rsdp_t *efi_acpi_validated_rsdp(void)
+{
+	return efi_acpi_init() == EFI_SUCCESS ? rsdp : NULL;
+}
+
+efi_acpi_header_t *efi_acpi_table(efi_u32_t signature, efi_size_t instance)
+{
+	efi_size_t slot, idx;
+
+	if (init_status == EFI_NOT_STARTED && EFI_ERROR(efi_acpi_init()))
+		return NULL;
+
+	slot = slot_of(signature);
+	if (!slots[slot])
+		return NULL;
+	for (idx = slots[slot] - 1; instance--; idx = tables[idx].next)
+		if (tables[idx].next == NO_TABLE)
+			return NULL;
+	return tables[idx].header;
+}
+
+efi_size_t efi_acpi_table_count(efi_u32_t signature)
+{
+	efi_size_t slot;
+
+	if (init_status == EFI_NOT_STARTED && EFI_ERROR(efi_acpi_init()))
+		return 0;
+
+	slot = slot_of(signature);
+	return slots[slot] ? tables[slots[slot] - 1].count : 0;
+}
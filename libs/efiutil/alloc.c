@@ -0,0 +1,762 @@
+/*
+ * Memory allocator
+ *
+ * Small requests are served from per size class free lists. The free lists
+ * are refilled by carving up pages, which are taken from larger page runs
+ * obtained from firmware with allocate_pages. Requests too big for any size
+ * class get their own page allocation.
+ *
+ * Every page handed out by the allocator starts with a header, so the owner
+ * of any pointer can be found by rounding it down to a page boundary.
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+/* Number of pages requested from firmware at once for small objects */
+#define RUN_PAGES	16
+
+/* Signature of every page header */
+#define PAGE_MAGIC	0x42534c45	/* "ELSB" */
+
+#ifdef EFI_ALLOC_STATS
+/* Tag our pages with OEM memory types, so they stand out in the memory map */
+#define RUN_MEMORY_TYPE		((efi_memory_type_t) EFI_ALLOC_RUN_MEMORY_TYPE)
+#define LARGE_MEMORY_TYPE	((efi_memory_type_t) EFI_ALLOC_LARGE_MEMORY_TYPE)
+#else
+#define RUN_MEMORY_TYPE		EFI_LOADER_DATA
+#define LARGE_MEMORY_TYPE	EFI_LOADER_DATA
+#endif
+
+/* Class of pages belonging to a single large allocation */
+#define CLASS_LARGE	0xffffffff
+
+struct page_hdr {
+	efi_u32_t magic;
+	efi_u32_t class;
+	/* Length in pages (run heads and large blocks only) */
+	efi_size_t pages;
+	/* Linkage on the run list or the large block list */
+	struct page_hdr *next;
+	struct page_hdr *prev;
+};
+
+/* Objects start at this offset in each page, keeps them 16 byte aligned */
+#define HDR_SIZE	32
+
+_Static_assert(sizeof(struct page_hdr) <= HDR_SIZE, "Page header too big");
+
+/*
+ * Size classes, each one is a multiple of 16 chosen to waste as little as
+ * possible from the EFI_PAGE_SIZE - HDR_SIZE bytes available in a page
+ */
+static const efi_u16_t class_size[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 336, 448, 576, 800, 1008, 1344, 2032
+};
+
+#define NUM_CLASSES	ARRAY_SIZE(class_size)
+#define MAX_SMALL	2032
+
+/* Free objects of each size class */
+static void *free_list[NUM_CLASSES];
+
+/* Page runs obtained from firmware, the current run is at the head */
+static struct page_hdr *runs;
+static efi_u8_t *run_next, *run_end;
+
+/* Large allocations */
+static struct page_hdr *large;
+
+#define ptr_to_hdr(ptr) \
+	((struct page_hdr *) ((efi_uptr_t) (ptr) & ~(efi_uptr_t) (EFI_PAGE_SIZE - 1)))
+
+static efi_u32_t size_to_class(efi_size_t size)
+{
+	efi_u32_t class;
+
+	for (class = 0; class_size[class] < size; ++class)
+		;
+	return class;
+}
+
+/* Take a page from the current run, starting a new run if needed */
+static struct page_hdr *get_page(void)
+{
+	efi_status_t status;
+	efi_physical_address_t addr;
+	struct page_hdr *hdr;
+
+	if (run_next == run_end) {
+		status = efi_bs->allocate_pages(EFI_ALLOCATE_ANY_PAGES,
+			RUN_MEMORY_TYPE, RUN_PAGES, &addr);
+		if (EFI_ERROR(status))
+			return NULL;
+
+		/* The first page of a run records the whole run */
+		hdr = (struct page_hdr *) (efi_uptr_t) addr;
+		hdr->pages = RUN_PAGES;
+		hdr->next = runs;
+		runs = hdr;
+
+		run_next = (efi_u8_t *) hdr;
+		run_end = run_next + RUN_PAGES * EFI_PAGE_SIZE;
+	}
+
+	hdr = (struct page_hdr *) run_next;
+	run_next += EFI_PAGE_SIZE;
+	return hdr;
+}
+
+/* Carve up a fresh page into objects of a size class */
+static efi_bool_t refill(efi_u32_t class)
+{
+	struct page_hdr *hdr;
+	efi_u8_t *obj;
+	efi_size_t size;
+
+	hdr = get_page();
+	if (!hdr)
+		return false;
+	hdr->magic = PAGE_MAGIC;
+	hdr->class = class;
+
+	/* Push objects in reverse, so they are handed out in address order */
+	size = class_size[class];
+	obj = (efi_u8_t *) hdr + HDR_SIZE
+		+ (EFI_PAGE_SIZE - HDR_SIZE) / size * size;
+	while ((obj -= size) >= (efi_u8_t *) hdr + HDR_SIZE) {
+		*(void **) obj = free_list[class];
+		free_list[class] = obj;
+	}
+
+	return true;
+}
+
+static void *alloc_large(efi_size_t size)
+{
+	efi_status_t status;
+	efi_physical_address_t addr;
+	efi_size_t pages;
+	struct page_hdr *hdr;
+
+	pages = EFI_SIZE_TO_PAGES(size + HDR_SIZE);
+	status = efi_bs->allocate_pages(EFI_ALLOCATE_ANY_PAGES,
+		LARGE_MEMORY_TYPE, pages, &addr);
+	if (EFI_ERROR(status))
+		efi_abort(L"Cannot allocate memory!\n", status);
+
+	hdr = (struct page_hdr *) (efi_uptr_t) addr;
+	hdr->magic = PAGE_MAGIC;
+	hdr->class = CLASS_LARGE;
+	hdr->pages = pages;
+	hdr->prev = NULL;
+	hdr->next = large;
+	if (large)
+		large->prev = hdr;
+	large = hdr;
+
+	return (efi_u8_t *) hdr + HDR_SIZE;
+}
+
+static void free_large(struct page_hdr *hdr)
+{
+	if (hdr->prev)
+		hdr->prev->next = hdr->next;
+	else
+		large = hdr->next;
+	if (hdr->next)
+		hdr->next->prev = hdr->prev;
+
+	hdr->magic = 0;
+	efi_bs->free_pages((efi_physical_address_t) (efi_uptr_t) hdr, hdr->pages);
+}
+
+static void *raw_alloc(efi_size_t size)
+{
+	efi_u32_t class;
+	void *obj;
+
+	if (size > MAX_SMALL)
+		return alloc_large(size);
+
+	class = size_to_class(size);
+	if (!free_list[class] && !refill(class))
+		efi_abort(L"Cannot allocate memory!\n", EFI_OUT_OF_RESOURCES);
+
+	obj = free_list[class];
+	free_list[class] = *(void **) obj;
+	return obj;
+}
+
+static void raw_free(void *ptr)
+{
+	struct page_hdr *hdr;
+
+	if (ptr == NULL)
+		return;
+
+	hdr = ptr_to_hdr(ptr);
+	if (hdr->magic != PAGE_MAGIC)
+		efi_abort(L"efi_free: invalid pointer!\n", EFI_INVALID_PARAMETER);
+
+	if (hdr->class == CLASS_LARGE) {
+		free_large(hdr);
+		return;
+	}
+
+	*(void **) ptr = free_list[hdr->class];
+	free_list[hdr->class] = ptr;
+}
+
+static efi_size_t raw_size(void *ptr)
+{
+	struct page_hdr *hdr;
+
+	hdr = ptr_to_hdr(ptr);
+	if (hdr->class == CLASS_LARGE)
+		return hdr->pages * EFI_PAGE_SIZE - HDR_SIZE;
+	return class_size[hdr->class];
+}
+
+/* Try to grow a large block by allocating the pages right after it */
+static efi_bool_t extend_large(struct page_hdr *hdr, efi_size_t pages)
+{
+	efi_status_t status;
+	efi_physical_address_t addr;
+
+	addr = (efi_physical_address_t) (efi_uptr_t) hdr + hdr->pages * EFI_PAGE_SIZE;
+	status = efi_bs->allocate_pages(EFI_ALLOCATE_FIXED_ADDRESS,
+		LARGE_MEMORY_TYPE, pages - hdr->pages, &addr);
+	if (EFI_ERROR(status))
+		return false;
+	hdr->pages = pages;
+	return true;
+}
+
+/* Give the pages past the end of a shrunk large block back to firmware */
+static void trim_large(struct page_hdr *hdr, efi_size_t pages)
+{
+	efi_bs->free_pages((efi_physical_address_t) (efi_uptr_t) hdr
+		+ pages * EFI_PAGE_SIZE, hdr->pages - pages);
+	hdr->pages = pages;
+}
+
+static void *resize(void *oldptr, efi_size_t copysize, efi_size_t newsize)
+{
+	struct page_hdr *hdr;
+	efi_size_t pages;
+	void *newptr;
+
+	if (oldptr == NULL)
+		return raw_alloc(newsize);
+
+	hdr = ptr_to_hdr(oldptr);
+	if (hdr->magic != PAGE_MAGIC)
+		efi_abort(L"efi_realloc: invalid pointer!\n", EFI_INVALID_PARAMETER);
+
+	if (hdr->class == CLASS_LARGE && newsize > MAX_SMALL) {
+		/* Large blocks stay put if their page count can be adjusted */
+		pages = EFI_SIZE_TO_PAGES(newsize + HDR_SIZE);
+		if (pages < hdr->pages)
+			trim_large(hdr, pages);
+		if (pages <= hdr->pages || extend_large(hdr, pages))
+			return oldptr;
+	} else if (newsize <= raw_size(oldptr)) {
+		/* Small blocks don't move while their size class has room */
+		return oldptr;
+	}
+
+	/* Last resort: move the contents to a new region */
+	newptr = raw_alloc(newsize);
+	if (copysize > newsize)
+		copysize = newsize;
+	memcpy(newptr, oldptr, copysize);
+	raw_free(oldptr);
+	return newptr;
+}
+
+#ifdef EFI_ALLOC_STATS
+
+/*
+ * Allocation accounting
+ *
+ * Each block is prefixed with a record of its size and call site, records of
+ * live blocks are kept on a list for the leak report.
+ */
+
+struct track {
+	struct track *next;
+	struct track *prev;
+	void *site;
+	efi_size_t size;
+};
+
+/* Keeps the 16 byte alignment of the blocks handed out */
+#define TRACK_SIZE	32
+
+_Static_assert(sizeof(struct track) <= TRACK_SIZE, "Track record too big");
+
+#define ptr_to_track(ptr)	((struct track *) ((efi_u8_t *) (ptr) - TRACK_SIZE))
+#define track_to_ptr(t)		((void *) ((efi_u8_t *) (t) + TRACK_SIZE))
+
+static struct {
+	efi_u64_t allocs;
+	efi_u64_t frees;
+	efi_u64_t reallocs;
+	efi_u64_t bytes;
+	efi_u64_t live_blocks;
+	efi_u64_t live_bytes;
+	efi_u64_t peak_bytes;
+} stats;
+
+/* Per call site totals, sites that don't fit are counted as other */
+#define NUM_SITES	64
+
+static struct site {
+	void *addr;
+	efi_u64_t allocs;
+	efi_u64_t bytes;
+	efi_u64_t live_bytes;
+} sites[NUM_SITES], other_site;
+
+/* Allocation sizes by bit length */
+static efi_u64_t histogram[8 * sizeof(efi_size_t) + 1];
+
+static struct track *live;
+
+static struct site *lookup_site(void *addr)
+{
+	efi_size_t i, n;
+
+	i = ((efi_uptr_t) addr >> 2) * 0x9e3779b1;
+	for (n = 0; n < NUM_SITES; ++n, ++i) {
+		i %= NUM_SITES;
+		if (sites[i].addr == addr)
+			return &sites[i];
+		if (sites[i].addr == NULL) {
+			sites[i].addr = addr;
+			return &sites[i];
+		}
+	}
+	return &other_site;
+}
+
+static efi_size_t size_bucket(efi_size_t size)
+{
+	efi_size_t bucket;
+
+	for (bucket = 0; size; size >>= 1)
+		++bucket;
+	return bucket;
+}
+
+static void track_add(struct track *t, efi_size_t size, void *site)
+{
+	struct site *s;
+
+	t->site = site;
+	t->size = size;
+	t->prev = NULL;
+	t->next = live;
+	if (live)
+		live->prev = t;
+	live = t;
+
+	++stats.live_blocks;
+	stats.live_bytes += size;
+	if (stats.live_bytes > stats.peak_bytes)
+		stats.peak_bytes = stats.live_bytes;
+
+	s = lookup_site(site);
+	s->live_bytes += size;
+}
+
+/* Unlinking a bad pointer would corrupt the list before raw_free notices */
+static struct track *checked_track(void *ptr, efi_ch16_t *error_msg)
+{
+	struct track *t = ptr_to_track(ptr);
+
+	if (ptr_to_hdr(t)->magic != PAGE_MAGIC)
+		efi_abort(error_msg, EFI_INVALID_PARAMETER);
+	return t;
+}
+
+static void track_del(struct track *t)
+{
+	if (t->prev)
+		t->prev->next = t->next;
+	else
+		live = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+
+	--stats.live_blocks;
+	stats.live_bytes -= t->size;
+	lookup_site(t->site)->live_bytes -= t->size;
+}
+
+static void count_alloc(efi_size_t size, void *site)
+{
+	struct site *s;
+
+	++stats.allocs;
+	stats.bytes += size;
+	++histogram[size_bucket(size)];
+
+	s = lookup_site(site);
+	++s->allocs;
+	s->bytes += size;
+}
+
+static void *tracked_resize(void *ptr, efi_size_t copysize, efi_size_t newsize, void *site)
+{
+	struct track *t;
+
+	if (ptr == NULL) {
+		t = raw_alloc(newsize + TRACK_SIZE);
+	} else {
+		++stats.reallocs;
+		t = checked_track(ptr, L"efi_realloc: invalid pointer!\n");
+		track_del(t);
+		t = resize(t, copysize + TRACK_SIZE, newsize + TRACK_SIZE);
+	}
+	count_alloc(newsize, site);
+	track_add(t, newsize, site);
+	return track_to_ptr(t);
+}
+
+void *efi_alloc(efi_size_t size)
+{
+	struct track *t;
+
+	t = raw_alloc(size + TRACK_SIZE);
+	count_alloc(size, __builtin_return_address(0));
+	track_add(t, size, __builtin_return_address(0));
+	return track_to_ptr(t);
+}
+
+void efi_free(void *ptr)
+{
+	struct track *t;
+
+	if (ptr == NULL)
+		return;
+
+	++stats.frees;
+	t = checked_track(ptr, L"efi_free: invalid pointer!\n");
+	track_del(t);
+	raw_free(t);
+}
+
+efi_size_t efi_alloc_size(void *ptr)
+{
+	return raw_size(ptr_to_track(ptr)) - TRACK_SIZE;
+}
+
+void *efi_realloc(void *oldptr, efi_size_t oldsize, efi_size_t newsize)
+{
+	return tracked_resize(oldptr, oldsize, newsize, __builtin_return_address(0));
+}
+
+void *efi_resize(void *ptr, efi_size_t newsize)
+{
+	return tracked_resize(ptr, ptr ? efi_alloc_size(ptr) : 0, newsize,
+		__builtin_return_address(0));
+}
+
+static void track_reset(void)
+{
+	efi_size_t i;
+
+	live = NULL;
+	stats.live_blocks = 0;
+	stats.live_bytes = 0;
+	for (i = 0; i < NUM_SITES; ++i)
+		sites[i].live_bytes = 0;
+	other_site.live_bytes = 0;
+}
+
+static void report_site(struct site *s)
+{
+	efi_print(L"  %p: %" EFI_PRIu64 " allocations, %" EFI_PRIu64 " bytes, %"
+		EFI_PRIu64 " bytes live\n", s->addr, s->allocs, s->bytes, s->live_bytes);
+}
+
+void efi_alloc_report(void)
+{
+	efi_size_t i;
+	struct track *t;
+
+	efi_print(L"efi_alloc: %" EFI_PRIu64 " allocations, %" EFI_PRIu64
+		" reallocations, %" EFI_PRIu64 " frees, %" EFI_PRIu64 " bytes total\n",
+		stats.allocs, stats.reallocs, stats.frees, stats.bytes);
+	efi_print(L"efi_alloc: %" EFI_PRIu64 " bytes live in %" EFI_PRIu64
+		" blocks, peak %" EFI_PRIu64 " bytes\n",
+		stats.live_bytes, stats.live_blocks, stats.peak_bytes);
+
+	efi_print(L"Allocation sizes:\n");
+	for (i = 0; i < ARRAY_SIZE(histogram); ++i)
+		if (histogram[i])
+			efi_print(L"  < 2^%-2zu: %" EFI_PRIu64 "\n", i, histogram[i]);
+
+	efi_print(L"Call sites:\n");
+	for (i = 0; i < NUM_SITES; ++i)
+		if (sites[i].addr)
+			report_site(&sites[i]);
+	if (other_site.allocs)
+		report_site(&other_site);
+
+	efi_print(L"Live blocks:\n");
+	for (t = live; t; t = t->next)
+		efi_print(L"  %p: %zu bytes from %p\n", track_to_ptr(t), t->size, t->site);
+}
+
+#else
+
+void *efi_alloc(efi_size_t size)
+{
+	return raw_alloc(size);
+}
+
+void efi_free(void *ptr)
+{
+	raw_free(ptr);
+}
+
+efi_size_t efi_alloc_size(void *ptr)
+{
+	return raw_size(ptr);
+}
+
+void *efi_realloc(void *oldptr, efi_size_t oldsize, efi_size_t newsize)
+{
+	return resize(oldptr, oldsize, newsize);
+}
+
+void *efi_resize(void *ptr, efi_size_t newsize)
+{
+	return resize(ptr, ptr ? raw_size(ptr) : 0, newsize);
+}
+
+#endif
+
+/*
+ * Scratch arena
+ *
+ * Chunks are kept on a list in allocation order, releasing to a mark just
+ * rewinds the bump pointer, keeping later chunks around for reuse.
+ */
+
+struct scratch_chunk {
+	struct scratch_chunk *next;
+	efi_size_t size;
+	efi_u8_t data[] __attribute__((aligned(16)));
+};
+
+/* Default chunk size, fills 16 pages exactly together with the page header */
+#define SCRATCH_CHUNK	(16 * EFI_PAGE_SIZE - HDR_SIZE - sizeof(struct scratch_chunk))
+
+static struct scratch_chunk *scratch_head, *scratch_cur;
+static efi_size_t scratch_off;
+
+efi_scratch_mark_t efi_scratch_mark(void)
+{
+	return (efi_scratch_mark_t) { scratch_cur, scratch_off };
+}
+
+void efi_scratch_release(efi_scratch_mark_t mark)
+{
+	scratch_cur = mark.chunk;
+	scratch_off = mark.offset;
+}
+
+void *efi_scratch_alloc(efi_size_t size)
+{
+	struct scratch_chunk *chunk;
+	void *ptr;
+
+	size = (size + 15) & ~(efi_size_t) 15;
+
+	if (!scratch_cur || scratch_off + size > scratch_cur->size) {
+		/* Move on to the next chunk, if there is one big enough */
+		chunk = scratch_cur ? scratch_cur->next : scratch_head;
+		if (!chunk || chunk->size < size) {
+			chunk = efi_alloc(sizeof(struct scratch_chunk)
+				+ (size > SCRATCH_CHUNK ? size : SCRATCH_CHUNK));
+			chunk->size = efi_alloc_size(chunk) - sizeof(struct scratch_chunk);
+			if (scratch_cur) {
+				chunk->next = scratch_cur->next;
+				scratch_cur->next = chunk;
+			} else {
+				chunk->next = scratch_head;
+				scratch_head = chunk;
+			}
+		}
+		scratch_cur = chunk;
+		scratch_off = 0;
+	}
+
+	ptr = scratch_cur->data + scratch_off;
+	scratch_off += size;
+	return ptr;
+}
+
+void efi_free_all(void)
+{
+	struct page_hdr *hdr, *next;
+	efi_u32_t class;
+
+	for (hdr = large; hdr; hdr = next) {
+		next = hdr->next;
+		efi_bs->free_pages((efi_physical_address_t) (efi_uptr_t) hdr, hdr->pages);
+	}
+	large = NULL;
+
+	/* Each run head lives inside its own run, so grab next first */
+	for (hdr = runs; hdr; hdr = next) {
+		next = hdr->next;
+		efi_bs->free_pages((efi_physical_address_t) (efi_uptr_t) hdr, hdr->pages);
+	}
+	runs = NULL;
+	run_next = run_end = NULL;
+
+	for (class = 0; class < NUM_CLASSES; ++class)
+		free_list[class] = NULL;
+
+	/* Scratch chunks were large blocks */
+	scratch_head = scratch_cur = NULL;
+	scratch_off = 0;
+
+	/* Indices elsewhere in efiutil pointed into the memory just freed */
+	config_reset();
+	smbios_reset();
+	dp_index_reset();
+
+#ifdef EFI_ALLOC_STATS
+	track_reset();
+#endif
+}
+
+/*
+ * Aligned page allocation
+ */
+
+/* Find the highest aligned free range below max_addr in the memory map */
+static efi_status_t find_aligned(efi_physical_address_t max_addr,
+	efi_size_t align, efi_size_t pages, efi_physical_address_t *out)
+{
+	efi_status_t status;
+	efi_scratch_mark_t mark;
+	efi_size_t map_size, map_key, desc_size;
+	efi_u32_t desc_ver;
+	efi_u8_t *map, *cur;
+	efi_memory_descriptor_t *desc;
+	efi_physical_address_t start, limit, candidate, len;
+
+	mark = efi_scratch_mark();
+	map = NULL;
+	map_size = 0;
+retry:
+	status = efi_bs->get_memory_map(&map_size,
+		(efi_memory_descriptor_t *) map, &map_key, &desc_size, &desc_ver);
+	if (status == EFI_BUFFER_TOO_SMALL) {
+		/* Room for descriptors created by the scratch allocation */
+		map_size += 4 * sizeof(efi_memory_descriptor_t);
+		efi_scratch_release(mark);
+		map = efi_scratch_alloc(map_size);
+		goto retry;
+	}
+	if (EFI_ERROR(status))
+		goto done;
+
+	status = EFI_NOT_FOUND;
+	len = (efi_physical_address_t) pages * EFI_PAGE_SIZE;
+	for (cur = map; cur < map + map_size; cur += desc_size) {
+		desc = (efi_memory_descriptor_t *) cur;
+		if (desc->type != EFI_CONVENTIONAL_MEMORY)
+			continue;
+
+		start = desc->start;
+		limit = start + desc->number_of_pages * EFI_PAGE_SIZE - 1;
+		if (limit > max_addr)
+			limit = max_addr;
+		if (limit < start || limit - start + 1 < len)
+			continue;
+
+		candidate = (limit - len + 1) & ~(efi_physical_address_t) (align - 1);
+		if (candidate < start)
+			continue;
+		if (status == EFI_NOT_FOUND || candidate > *out) {
+			*out = candidate;
+			status = EFI_SUCCESS;
+		}
+	}
+
+done:
+	efi_scratch_release(mark);
+	return status;
+}
+
+efi_status_t efi_alloc_pages(efi_memory_type_t memory_type,
+	efi_physical_address_t max_addr, efi_size_t align, efi_size_t size,
+	efi_pages_t *out)
+{
+	efi_status_t status;
+	efi_physical_address_t addr, aligned;
+	efi_size_t pages, extra, head;
+
+	/* Without a limit, stay within reach of our pointers */
+	if (max_addr == 0 || max_addr > (efi_uptr_t) -1)
+		max_addr = (efi_uptr_t) -1;
+	if (align < EFI_PAGE_SIZE)
+		align = EFI_PAGE_SIZE;
+	if (align & (align - 1))
+		return EFI_INVALID_PARAMETER;
+	pages = EFI_SIZE_TO_PAGES(size);
+
+	/* Page alignment is all firmware guarantees on its own */
+	if (align == EFI_PAGE_SIZE) {
+		addr = max_addr;
+		status = efi_bs->allocate_pages(EFI_ALLOCATE_MAX_ADDRESS,
+			memory_type, pages, &addr);
+		goto done;
+	}
+
+	/* Ask for exactly the pages we need at an address picked from the map */
+	if (!EFI_ERROR(find_aligned(max_addr, align, pages, &addr))) {
+		status = efi_bs->allocate_pages(EFI_ALLOCATE_FIXED_ADDRESS,
+			memory_type, pages, &addr);
+		if (!EFI_ERROR(status))
+			goto done;
+	}
+
+	/* Otherwise over-allocate, then give back the head and the tail */
+	extra = align / EFI_PAGE_SIZE - 1;
+	addr = max_addr;
+	status = efi_bs->allocate_pages(EFI_ALLOCATE_MAX_ADDRESS,
+		memory_type, pages + extra, &addr);
+	if (EFI_ERROR(status))
+		goto done;
+
+	aligned = (addr + align - 1) & ~(efi_physical_address_t) (align - 1);
+	head = (aligned - addr) / EFI_PAGE_SIZE;
+	if (head)
+		efi_bs->free_pages(addr, head);
+	if (extra - head)
+		efi_bs->free_pages(aligned + pages * EFI_PAGE_SIZE, extra - head);
+	addr = aligned;
+
+done:
+	if (EFI_ERROR(status))
+		return status;
+	out->base = addr;
+	out->pages = pages;
+	return status;
+}
+
+void efi_free_pages(efi_pages_t *pages)
+{
+	efi_bs->free_pages(pages->base, pages->pages);
+	pages->base = 0;
+	pages->pages = 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Persistent boot log
+ */
+#include <efi.h>
+#include <efiutil.h>
+
+// Records start on this boundary, so padding always fits a record header
+#define RECORD_ALIGN 16
+#define RECORD_SIZE(len) \
+	((sizeof(efi_boot_log_record_t) + (len) + 1 + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1))
+
+static efi_boot_log_t *boot_log;
+
+static efi_boot_log_record_t *record_at(efi_boot_log_t *log, efi_u32_t offset)
+{
+	return (efi_boot_log_record_t *) (log->records + offset);
+}
+
+/* Drop the oldest records until n bytes are free after head */
+static void make_room(efi_boot_log_t *log, efi_u32_t n)
+{
+	while (log->size - log->used < n) {
+		efi_u32_t size = record_at(log, log->tail)->size;
+		log->used -= size;
+		log->tail += size;
+		if (log->tail == log->size)
+			log->tail = 0;
+	}
+}
+
+static efi_boot_log_record_t *reserve(efi_boot_log_t *log, efi_u32_t n)
+{
+	efi_boot_log_record_t *rec;
+	efi_u32_t pad;
+
+	/* Records never wrap, fill the end of the ring with padding instead */
+	pad = log->size - log->head;
+	if (pad < n) {
+		make_room(log, pad);
+		rec = record_at(log, log->head);
+		rec->timestamp = 0;
+		rec->size = pad;
+		rec->length = EFI_BOOT_LOG_PADDING;
+		log->used += pad;
+		log->head = 0;
+	}
+
+	make_room(log, n);
+	rec = record_at(log, log->head);
+	log->used += n;
+	log->head += n;
+	if (log->head == log->size)
+		log->head = 0;
+	return rec;
+}
+
+static void boot_log_write(efi_log_sink_t *sink, efi_ch16_t *str, efi_size_t len)
+{
+	efi_boot_log_t *log = boot_log;
+	efi_boot_log_record_t *rec;
+
+	(void) sink;
+
+	/* One record per line, without the line ending */
+	while (len && (str[len - 1] == L'\n' || str[len - 1] == L'\r'))
+		--len;
+	while (RECORD_SIZE(len) > log->size)
+		--len;
+
+	rec = reserve(log, RECORD_SIZE(len));
+	rec->timestamp = efi_rdtsc();
+	rec->size = RECORD_SIZE(len);
+	rec->length = len;
+	for (efi_size_t i = 0; i < len; ++i)
+		rec->text[i] = str[i] < 0x80 ? str[i] : '?';
+	rec->text[len] = 0;
+}
+
+static efi_log_sink_t boot_log_sink = {
+	.write = boot_log_write,
+	.boot_services = false,
+};
+
+/* Measure the timestamp counter against a 1ms stall */
+static efi_u64_t tsc_frequency(void)
+{
+	efi_u64_t start = efi_rdtsc();
+	efi_bs->stall(1000);
+	return (efi_rdtsc() - start) * 1000;
+}
+
+efi_status_t efi_boot_log_init(efi_size_t size)
+{
+	efi_physical_address_t addr;
+	efi_size_t pages;
+	efi_status_t status;
+
+	if (boot_log)
+		return EFI_ALREADY_STARTED;
+
+	pages = EFI_SIZE_TO_PAGES(sizeof(efi_boot_log_t) + size);
+	status = efi_bs->allocate_pages(EFI_ALLOCATE_ANY_PAGES,
+		EFI_RUNTIME_SERVICES_DATA, pages, &addr);
+	if (EFI_ERROR(status))
+		return status;
+
+	efi_boot_log_t *log = (efi_boot_log_t *) (efi_uptr_t) addr;
+	log->signature = EFI_BOOT_LOG_SIGNATURE;
+	log->tsc_frequency = tsc_frequency();
+	log->size = (pages * EFI_PAGE_SIZE - sizeof(efi_boot_log_t))
+		& ~(RECORD_ALIGN - 1);
+	log->head = 0;
+	log->tail = 0;
+	log->used = 0;
+
+	status = efi_install_configuration_table(
+		&(efi_guid_t) EFI_BOOT_LOG_GUID, log);
+	if (EFI_ERROR(status)) {
+		efi_bs->free_pages(addr, pages);
+		return status;
+	}
+
+	boot_log = log;
+	efi_log_attach(&boot_log_sink);
+	return EFI_SUCCESS;
+}
+
+efi_boot_log_t *efi_boot_log(void)
+{
+	return boot_log;
+}
+
+efi_status_t efi_boot_log_checkpoint(efi_size_t max_size)
+{
+	efi_boot_log_record_t *rec, *first;
+	efi_boot_log_t *copy;
+	efi_u32_t bytes = 0, offset = 0;
+	efi_status_t status;
+
+	if (!boot_log)
+		return EFI_NOT_STARTED;
+	if (max_size < sizeof(efi_boot_log_t))
+		return EFI_INVALID_PARAMETER;
+
+	efi_flush();
+
+	/* Only records are copied, dropping the oldest ones that don't fit */
+	for (rec = efi_boot_log_next(boot_log, NULL); rec;
+			rec = efi_boot_log_next(boot_log, rec))
+		bytes += rec->size;
+	for (first = efi_boot_log_next(boot_log, NULL);
+			bytes > max_size - sizeof(efi_boot_log_t);
+			first = efi_boot_log_next(boot_log, first))
+		bytes -= first->size;
+
+	/* Lined up from offset 0, so the copy is a full ring without padding */
+	copy = efi_alloc(sizeof(efi_boot_log_t) + bytes);
+	*copy = *boot_log;
+	copy->size = bytes;
+	copy->head = 0;
+	copy->tail = 0;
+	copy->used = bytes;
+	for (rec = first; rec; rec = efi_boot_log_next(boot_log, rec)) {
+		memcpy(copy->records + offset, rec, rec->size);
+		offset += rec->size;
+	}
+
+	status = efi_rt->set_variable(EFI_BOOT_LOG_VARIABLE,
+		&(efi_guid_t) EFI_BOOT_LOG_GUID,
+		EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS,
+		sizeof(efi_boot_log_t) + bytes, copy);
+	efi_free(copy);
+	return status;
+}
+
+efi_boot_log_record_t *efi_boot_log_next(efi_boot_log_t *log,
+	efi_boot_log_record_t *rec)
+{
+	efi_u32_t offset, seen;
+
+	if (rec) {
+		offset = (efi_u8_t *) rec - log->records;
+		seen = (offset + log->size - log->tail) % log->size + rec->size;
+		offset = (offset + rec->size) % log->size;
+	} else {
+		offset = log->tail;
+		seen = 0;
+	}
+
+	for (; seen < log->used; seen += rec->size) {
+		rec = record_at(log, offset);
+		if (rec->length != EFI_BOOT_LOG_PADDING)
+			return rec;
+		offset = (offset + rec->size) % log->size;
+	}
+	return NULL;
+}
@@ -0,0 +1,103 @@
+/*
+ * Configuration table index
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+/*
+ * Slots hold the index of an entry in efi_st->config_entries plus 1, so a
+ * replaced table pointer is seen without a rebuild. Adding or removing
+ * entries changes the array or its size, which is checked on every lookup.
+ */
+static efi_u32_t *slots;
+static efi_size_t mask;
+static efi_configuration_table_t *indexed_entries;
+static efi_size_t indexed_cnt;
+
+static efi_u32_t hash_guid(const efi_guid_t *guid)
+{
+	efi_u64_t w[2];
+
+	__builtin_memcpy(w, guid, sizeof(w));
+	w[0] ^= w[1];
+	return (w[0] ^ (w[0] >> 32)) * 0x9e3779b1;
+}
+
+void efi_config_table_refresh(void)
+{
+	efi_size_t size;
+
+	efi_free(slots);
+	for (size = 16; size < efi_st->cnt_config_entries * 2; size *= 2)
+		;
+	slots = efi_alloc(size * sizeof(*slots));
+	memset(slots, 0, size * sizeof(*slots));
+	mask = size - 1;
+
+	/* Walk backwards, so the first of any duplicate GUIDs wins lookups */
+	for (efi_size_t i = efi_st->cnt_config_entries; i-- > 0; ) {
+		efi_size_t j = hash_guid(&efi_st->config_entries[i].vendor_guid) & mask;
+		while (slots[j])
+			j = (j + 1) & mask;
+		slots[j] = i + 1;
+	}
+
+	indexed_entries = efi_st->config_entries;
+	indexed_cnt = efi_st->cnt_config_entries;
+}
+
+void config_reset(void)
+{
+	slots = NULL;
+	mask = 0;
+	indexed_entries = NULL;
+	indexed_cnt = 0;
+}
+
+void *efi_config_table(efi_guid_t *guid)
+{
+	efi_configuration_table_t *entry;
+	efi_u32_t idx;
+
+	if (!slots || indexed_entries != efi_st->config_entries
+			|| indexed_cnt != efi_st->cnt_config_entries)
+		efi_config_table_refresh();
+
+	for (efi_size_t j = hash_guid(guid) & mask; (idx = slots[j]); j = (j + 1) & mask) {
+		entry = &efi_st->config_entries[idx - 1];
+		if (efi_guid_eq(&entry->vendor_guid, guid))
+			return entry->vendor_table;
+	}
+	return NULL;
+}
+
+efi_status_t efi_install_configuration_table(efi_guid_t *guid, void *table)
+{
+	efi_status_t status;
+
+	status = efi_bs->install_configuration_table(guid, table);
+	if (!EFI_ERROR(status))
+		efi_config_table_refresh();
+	return status;
+}
+
+void *efi_acpi_rsdp(void)
+{
+	void *rsdp;
+
+	rsdp = efi_config_table(&(efi_guid_t) EFI_ACPI_20_TABLE_GUID);
+	if (!rsdp)
+		rsdp = efi_config_table(&(efi_guid_t) EFI_ACPI_10_TABLE_GUID);
+	return rsdp;
+}
+
+void *efi_smbios_entry_point(void)
+{
+	void *entry;
+
+	entry = efi_config_table(&(efi_guid_t) EFI_SMBIOS3_TABLE_GUID);
+	if (!entry)
+		entry = efi_config_table(&(efi_guid_t) EFI_SMBIOS_TABLE_GUID);
+	return entry;
+}
@@ -0,0 +1,84 @@
+/*
+ * CPU feature detection
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+static efi_u32_t cpu_features;
+
+void efi_cpuid(efi_u32_t leaf, efi_u32_t subleaf, efi_u32_t regs[4])
+{
+	asm volatile ("cpuid"
+		: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+		: "a" (leaf), "c" (subleaf));
+}
+
+/* SSE state is only usable if firmware enabled it in CR0 and CR4 */
+static efi_bool_t sse_enabled(void)
+{
+	efi_uptr_t cr0, cr4;
+
+	asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+	asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+	return !(cr0 & (1 << 2)) && (cr4 & (1 << 9));	/* !EM && OSFXSR */
+}
+
+/* AVX state must be enabled in XCR0 as well */
+static efi_bool_t avx_enabled(void)
+{
+	efi_u32_t lo, hi;
+
+	asm volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	return (lo & 6) == 6;	/* XMM and YMM state */
+}
+
+void cpu_init(void)
+{
+	efi_u32_t regs[4], max_leaf;
+
+	cpu_features = 0;
+
+	efi_cpuid(0, 0, regs);
+	max_leaf = regs[0];
+	if (max_leaf < 1)
+		return;
+
+	efi_cpuid(1, 0, regs);
+	if ((regs[3] & (1 << 26)) && sse_enabled()) {
+		cpu_features |= EFI_CPU_SSE2;
+		if (regs[2] & (1 << 1))
+			cpu_features |= EFI_CPU_PCLMUL;
+		if (regs[2] & (1 << 19))
+			cpu_features |= EFI_CPU_SSE41;
+		if (regs[2] & (1 << 20))
+			cpu_features |= EFI_CPU_SSE42;
+		/* AVX and OSXSAVE */
+		if ((regs[2] & (1 << 28)) && (regs[2] & (1 << 27)) && avx_enabled())
+			cpu_features |= EFI_CPU_AVX;
+	}
+
+	if (max_leaf < 7)
+		return;
+
+	efi_cpuid(7, 0, regs);
+	if ((cpu_features & EFI_CPU_AVX) && (regs[1] & (1 << 5)))
+		cpu_features |= EFI_CPU_AVX2;
+	if (regs[1] & (1 << 9))
+		cpu_features |= EFI_CPU_ERMS;
+	if (regs[3] & (1 << 4))
+		cpu_features |= EFI_CPU_FSRM;
+}
+
+efi_bool_t efi_cpu_has(efi_u32_t features)
+{
+	return (cpu_features & features) == features;
+}
+
+efi_u64_t efi_rdtsc(void)
+{
+	efi_u32_t lo, hi;
+
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return (efi_u64_t) hi << 32 | lo;
+}
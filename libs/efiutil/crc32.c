@@ -0,0 +1,125 @@
+/*
+ * CRC32, the IEEE 802.3 one UEFI uses too
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+#define CRC32_POLY 0xedb88320	/* Bit reflected */
+
+/*
+ * Slice-by-8: table[k][b] is the CRC of byte b followed by k zero bytes,
+ * so eight bytes are folded in with eight independent lookups
+ */
+static efi_u32_t table[8][256];
+static crc32_kernel_t kernel;
+
+void crc32_init(void)
+{
+	for (efi_u32_t b = 0; b < 256; ++b) {
+		efi_u32_t crc = b;
+		for (int i = 0; i < 8; ++i)
+			crc = crc >> 1 ^ (crc & 1 ? CRC32_POLY : 0);
+		table[0][b] = crc;
+	}
+	for (efi_u32_t b = 0; b < 256; ++b)
+		for (int k = 1; k < 8; ++k)
+			table[k][b] = table[k - 1][b] >> 8 ^ table[0][table[k - 1][b] & 0xff];
+
+	kernel = simd_crc32_init();
+}
+
+static efi_u32_t load32(const efi_u8_t *p)
+{
+	efi_u32_t val;
+
+	__builtin_memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static efi_u32_t slice8(efi_u32_t crc, const efi_u8_t *p, efi_size_t len)
+{
+	for (; len >= 8; p += 8, len -= 8) {
+		efi_u32_t lo = load32(p) ^ crc, hi = load32(p + 4);
+		crc = table[7][lo & 0xff] ^ table[6][lo >> 8 & 0xff]
+			^ table[5][lo >> 16 & 0xff] ^ table[4][lo >> 24]
+			^ table[3][hi & 0xff] ^ table[2][hi >> 8 & 0xff]
+			^ table[1][hi >> 16 & 0xff] ^ table[0][hi >> 24];
+	}
+	for (; len; ++p, --len)
+		crc = crc >> 8 ^ table[0][(crc ^ *p) & 0xff];
+	return crc;
+}
+
+efi_u32_t efi_crc32_update(efi_u32_t crc, const void *data, efi_size_t len)
+{
+	const efi_u8_t *p = data;
+
+	crc = ~crc;
+	if (kernel && len >= 64) {
+		efi_size_t n = len & ~(efi_size_t) 15;
+		crc = kernel(crc, p, n);
+		p += n;
+		len -= n;
+	}
+	return ~slice8(crc, p, len);
+}
+
+efi_u32_t efi_crc32(const void *data, efi_size_t len)
+{
+	return efi_crc32_update(0, data, len);
+}
+
+/* Compare one buffer against the firmware, split in two to test chaining */
+static efi_status_t check_one(efi_u8_t *buf, efi_size_t len)
+{
+	efi_u32_t expect, crc;
+
+	/* Without the reference nothing was compared */
+	if (EFI_ERROR(efi_bs->calculate_crc32(buf, len, &expect)))
+		return EFI_UNSUPPORTED;
+	crc = efi_crc32_update(efi_crc32(buf, len / 3), buf + len / 3, len - len / 3);
+	if (crc != expect || efi_crc32(buf, len) != expect)
+		return EFI_CRC_ERROR;
+	return EFI_SUCCESS;
+}
+
+/* Check every length at a few alignments with the current setup */
+static efi_status_t check_all(efi_u8_t *buf)
+{
+	static const efi_size_t lengths[] = { 1, 7, 8, 15, 63, 64, 65, 80, 127, 128, 333, 4096 };
+	efi_status_t status;
+
+	for (efi_size_t i = 0; i < ARRAY_SIZE(lengths); ++i)
+		for (efi_size_t offset = 0; offset < 8; offset += 3) {
+			status = check_one(buf + offset, lengths[i]);
+			if (EFI_ERROR(status))
+				return status;
+		}
+	return EFI_SUCCESS;
+}
+
+efi_status_t efi_crc32_self_check(void)
+{
+	efi_scratch_mark_t mark = efi_scratch_mark();
+	crc32_kernel_t saved = kernel;
+	efi_status_t status;
+	efi_u8_t *buf;
+
+	buf = efi_scratch_alloc(4096 + 8);
+	for (efi_size_t i = 0; i < 4096 + 8; ++i)
+		buf[i] = i * 167 + (i >> 8);
+
+	kernel = NULL;
+	status = check_all(buf);
+	kernel = saved;
+
+	/* A kernel that disagrees with the firmware is not used again */
+	if (saved && status != EFI_UNSUPPORTED && EFI_ERROR(check_all(buf))) {
+		kernel = NULL;
+		status = EFI_CRC_ERROR;
+	}
+
+	efi_scratch_release(mark);
+	return status;
+}
@@ -0,0 +1,150 @@
+/*
+ * Device path construction
+ */
+#include <efi.h>
+#include <efiutil.h>
+
+efi_size_t efi_dp_len(efi_device_path_protocol_t *dp)
+{
+	efi_device_path_protocol_t *first;
+
+	first = dp;
+
+	while (!EFI_DP_IS_END(dp)) {
+		dp = EFI_DP_NEXT_NODE(dp);
+	}
+
+	return (efi_size_t) dp - (efi_size_t) first;
+}
+
+static void fill_node_header(efi_device_path_protocol_t *node,
+	efi_u8_t type, efi_u8_t sub_type, efi_size_t len)
+{
+	node->type = type;
+	node->sub_type = sub_type;
+	node->length[0] = len;
+	node->length[1] = len >> 8;
+}
+
+void efi_dpb_init(efi_dp_builder_t *dpb, efi_size_t size_hint)
+{
+	dpb->len = 0;
+	if (size_hint) {
+		dpb->size = size_hint + sizeof(efi_device_path_protocol_t);
+		dpb->buf = efi_alloc(dpb->size);
+	} else {
+		dpb->size = 0;
+		dpb->buf = NULL;
+	}
+}
+
+void efi_dpb_free(efi_dp_builder_t *dpb)
+{
+	efi_free(dpb->buf);
+	efi_dpb_init(dpb, 0);
+}
+
+// Make room for len more bytes, plus the end node written by efi_dpb_finish
+static void *dpb_reserve(efi_dp_builder_t *dpb, efi_size_t len)
+{
+	efi_size_t need;
+	void *ptr;
+
+	need = dpb->len + len + sizeof(efi_device_path_protocol_t);
+	if (need > dpb->size) {
+		dpb->size = dpb->size * 2 > need ? dpb->size * 2 : need;
+		dpb->buf = efi_resize(dpb->buf, dpb->size);
+	}
+
+	ptr = dpb->buf + dpb->len;
+	dpb->len += len;
+	return ptr;
+}
+
+void *efi_dpb_add_node(efi_dp_builder_t *dpb, efi_u8_t type, efi_u8_t sub_type,
+	efi_size_t len)
+{
+	efi_device_path_protocol_t *node;
+
+	node = dpb_reserve(dpb, len);
+	fill_node_header(node, type, sub_type, len);
+	return node;
+}
+
+void efi_dpb_append_node(efi_dp_builder_t *dpb, efi_device_path_protocol_t *node)
+{
+	efi_size_t len = EFI_DP_NODE_LEN(node);
+
+	memcpy(dpb_reserve(dpb, len), node, len);
+}
+
+void efi_dpb_append_path(efi_dp_builder_t *dpb, efi_device_path_protocol_t *dp,
+	efi_size_t len)
+{
+	if (len == EFI_DP_UNKNOWN_LEN)
+		len = efi_dp_len(dp);
+	memcpy(dpb_reserve(dpb, len), dp, len);
+}
+
+/* size is efi_strsize(file_path), for callers that already know it */
+static void append_file_path(efi_dp_builder_t *dpb, efi_ch16_t *file_path,
+	efi_size_t size)
+{
+	efi_filepath_device_path_t *node;
+
+	node = efi_dpb_add_node(dpb, EFI_MEDIA_DEVICE_PATH,
+		EFI_MEDIA_FILEPATH_DEVICE_PATH,
+		sizeof(efi_device_path_protocol_t) + size);
+	memcpy(node->path_name, file_path, size);
+}
+
+void efi_dpb_append_file_path(efi_dp_builder_t *dpb, efi_ch16_t *file_path)
+{
+	append_file_path(dpb, file_path, efi_strsize(file_path));
+}
+
+efi_device_path_protocol_t *efi_dpb_finish(efi_dp_builder_t *dpb, efi_size_t *size)
+{
+	efi_device_path_protocol_t *dp;
+
+	/* Appending always leaves room for the end node */
+	dpb_reserve(dpb, 0);
+	fill_node_header((efi_device_path_protocol_t *) (dpb->buf + dpb->len),
+		EFI_END_DEVICE_PATH_TYPE, EFI_END_ENTIRE_DEVICE_PATH_SUBTYPE,
+		sizeof(efi_device_path_protocol_t));
+	dpb->len += sizeof(efi_device_path_protocol_t);
+
+	dp = (efi_device_path_protocol_t *) dpb->buf;
+	if (size)
+		*size = dpb->len;
+	efi_dpb_init(dpb, 0);
+	return dp;
+}
+
+efi_device_path_protocol_t *efi_dp_merge(efi_device_path_protocol_t *first, efi_device_path_protocol_t *second)
+{
+	efi_dp_builder_t dpb;
+	efi_size_t first_len, second_len;
+
+	first_len = efi_dp_len(first);
+	second_len = efi_dp_len(second);
+
+	efi_dpb_init(&dpb, first_len + second_len);
+	efi_dpb_append_path(&dpb, first, first_len);
+	efi_dpb_append_path(&dpb, second, second_len);
+	return efi_dpb_finish(&dpb, NULL);
+}
+
+efi_device_path_protocol_t *efi_dp_append_file_path(efi_device_path_protocol_t *base, efi_ch16_t *file_path)
+{
+	efi_dp_builder_t dpb;
+	efi_size_t base_len, size;
+
+	base_len = efi_dp_len(base);
+	size = efi_strsize(file_path);
+
+	efi_dpb_init(&dpb, base_len + sizeof(efi_device_path_protocol_t) + size);
+	efi_dpb_append_path(&dpb, base, base_len);
+	append_file_path(&dpb, file_path, size);
+	return efi_dpb_finish(&dpb, NULL);
+}
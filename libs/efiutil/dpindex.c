@@ -0,0 +1,262 @@
+/*
+ * Device path index
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+/*
+ * Every handle's device path is entered once for each of its prefixes that
+ * end at a node boundary, the whole path included. Hashes are FNV-1a, which
+ * can be extended a node at a time, so the hashes of all prefixes of a path
+ * fall out of a single pass over it.
+ */
+struct entry {
+	efi_u32_t hash;			/* 0 marks an empty slot */
+	efi_u32_t prefix_len;		/* Bytes of path covered by hash */
+	efi_u32_t path_len;		/* Bytes of the whole path, without the end node */
+	efi_handle_t handle;
+	efi_u8_t *path;			/* Copy of the handle's path */
+};
+
+static struct entry *table;
+static efi_size_t table_mask;
+static efi_u8_t *paths;
+static efi_bool_t dirty = true;
+static efi_event_t notify_event;
+
+#define FNV_BASIS 0x811c9dc5
+#define FNV_PRIME 0x01000193
+
+static efi_u32_t hash_bytes(efi_u32_t hash, efi_u8_t *data, efi_size_t len)
+{
+	for (efi_size_t i = 0; i < len; ++i)
+		hash = (hash ^ data[i]) * FNV_PRIME;
+	return hash;
+}
+
+static efi_u32_t final_hash(efi_u32_t hash)
+{
+	return hash ? hash : 1;
+}
+
+static void insert(efi_u32_t hash, efi_u32_t prefix_len, efi_u32_t path_len,
+	efi_handle_t handle, efi_u8_t *path)
+{
+	efi_size_t i;
+
+	for (i = hash & table_mask; table[i].hash; i = (i + 1) & table_mask)
+		;
+	table[i].hash = hash;
+	table[i].prefix_len = prefix_len;
+	table[i].path_len = path_len;
+	table[i].handle = handle;
+	table[i].path = path;
+}
+
+static void clear(void)
+{
+	efi_free(table);
+	efi_free(paths);
+	table = NULL;
+	paths = NULL;
+	table_mask = 0;
+}
+
+efi_status_t efi_dp_index_refresh(void)
+{
+	efi_guid_t dp_guid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+	efi_device_path_protocol_t *dp, *node;
+	efi_size_t num_handles, num_entries, total, size;
+	efi_handle_t *handles;
+	efi_status_t status;
+	efi_u8_t *copy;
+
+	status = efi_locate_all_handles(&dp_guid, &num_handles, &handles);
+	if (status == EFI_NOT_FOUND) {
+		num_handles = 0;
+		handles = NULL;
+	} else if (EFI_ERROR(status)) {
+		return status;
+	}
+
+	/* Size the table and the path copies first */
+	num_entries = 0;
+	total = 0;
+	for (efi_size_t i = 0; i < num_handles; ++i) {
+		if (EFI_ERROR(efi_bs->handle_protocol(handles[i], &dp_guid, (void **) &dp))) {
+			handles[i] = NULL;
+			continue;
+		}
+		EFI_DP_FOR_EACH(node, dp)
+			++num_entries;
+		total += efi_dp_len(dp) + sizeof(efi_device_path_protocol_t);
+	}
+
+	clear();
+	for (size = 16; size < num_entries * 2; size *= 2)
+		;
+	table = efi_alloc(size * sizeof(*table));
+	memset(table, 0, size * sizeof(*table));
+	table_mask = size - 1;
+	paths = copy = efi_alloc(total ? total : 1);
+
+	for (efi_size_t i = 0; i < num_handles; ++i) {
+		efi_u32_t hash = FNV_BASIS, len;
+
+		if (!handles[i])
+			continue;
+		efi_bs->handle_protocol(handles[i], &dp_guid, (void **) &dp);
+		len = efi_dp_len(dp);
+		/* Copies keep their end node, so they can be walked like any path */
+		memcpy(copy, dp, len + sizeof(efi_device_path_protocol_t));
+
+		EFI_DP_FOR_EACH(node, (efi_device_path_protocol_t *) copy) {
+			hash = hash_bytes(hash, (efi_u8_t *) node, EFI_DP_NODE_LEN(node));
+			insert(final_hash(hash), (efi_u8_t *) EFI_DP_NEXT_NODE(node) - copy,
+				len, handles[i], copy);
+		}
+		copy += len + sizeof(efi_device_path_protocol_t);
+	}
+
+	efi_free(handles);
+	dirty = false;
+	return EFI_SUCCESS;
+}
+
+static efi_status_t efiapi notify(efi_event_t event, void *context)
+{
+	(void) event;
+	(void) context;
+
+	/* Allocating here is not safe, the next query rebuilds */
+	dirty = true;
+	return EFI_SUCCESS;
+}
+
+efi_status_t efi_dp_index_watch(void)
+{
+	efi_guid_t dp_guid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+	efi_status_t status;
+	void *registration;
+
+	if (notify_event)
+		return EFI_SUCCESS;
+
+	status = efi_bs->create_event(EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+		notify, NULL, &notify_event);
+	if (EFI_ERROR(status))
+		return status;
+
+	status = efi_bs->register_protocol_notify(&dp_guid, notify_event, &registration);
+	if (EFI_ERROR(status)) {
+		efi_bs->close_event(notify_event);
+		notify_event = NULL;
+	}
+	return status;
+}
+
+void efi_dp_index_unwatch(void)
+{
+	if (notify_event) {
+		efi_bs->close_event(notify_event);
+		notify_event = NULL;
+	}
+	clear();
+	dirty = true;
+}
+
+void dp_index_reset(void)
+{
+	table = NULL;
+	table_mask = 0;
+	paths = NULL;
+	dirty = true;
+}
+
+void efi_dp_index_invalidate(void)
+{
+	dirty = true;
+}
+
+static efi_bool_t ensure_fresh(void)
+{
+	return !dirty || !EFI_ERROR(efi_dp_index_refresh());
+}
+
+/* Walk the entries with hash h, callers check the paths themselves */
+#define FOR_EACH_SLOT(e, h) \
+	for (efi_size_t i_ = (h) & table_mask; \
+		(e = &table[i_])->hash; i_ = (i_ + 1) & table_mask) \
+		if (e->hash == (h))
+
+efi_handle_t efi_dp_index_find(efi_device_path_protocol_t *dp)
+{
+	efi_u32_t hash, len;
+	struct entry *e;
+
+	if (!ensure_fresh())
+		return NULL;
+
+	len = efi_dp_len(dp);
+	if (len == 0)
+		return NULL;
+	hash = final_hash(hash_bytes(FNV_BASIS, (efi_u8_t *) dp, len));
+
+	FOR_EACH_SLOT(e, hash)
+		if (e->prefix_len == len && e->path_len == len && !memcmp(e->path, dp, len))
+			return e->handle;
+	return NULL;
+}
+
+efi_handle_t efi_dp_index_find_prefix(efi_device_path_protocol_t *dp,
+	efi_device_path_protocol_t **remaining)
+{
+	efi_device_path_protocol_t *node, *rest = dp;
+	efi_handle_t found = NULL;
+	efi_u32_t hash = FNV_BASIS, hash_final, len;
+	struct entry *e;
+
+	if (!ensure_fresh())
+		return NULL;
+
+	/* Check each prefix of dp as a whole path, the last hit is the longest */
+	EFI_DP_FOR_EACH(node, dp) {
+		hash = hash_bytes(hash, (efi_u8_t *) node, EFI_DP_NODE_LEN(node));
+		hash_final = final_hash(hash);
+		len = (efi_u8_t *) EFI_DP_NEXT_NODE(node) - (efi_u8_t *) dp;
+		FOR_EACH_SLOT(e, hash_final)
+			if (e->prefix_len == len && e->path_len == len
+					&& !memcmp(e->path, dp, len)) {
+				found = e->handle;
+				rest = EFI_DP_NEXT_NODE(node);
+				break;
+			}
+	}
+
+	if (found && remaining)
+		*remaining = rest;
+	return found;
+}
+
+efi_size_t efi_dp_index_children(efi_device_path_protocol_t *dp,
+	efi_handle_t *handles, efi_size_t max)
+{
+	efi_u32_t hash, len;
+	efi_size_t count = 0;
+	struct entry *e;
+
+	if (!ensure_fresh())
+		return 0;
+
+	len = efi_dp_len(dp);
+	hash = final_hash(hash_bytes(FNV_BASIS, (efi_u8_t *) dp, len));
+
+	FOR_EACH_SLOT(e, hash)
+		if (e->prefix_len == len && e->path_len > len && !memcmp(e->path, dp, len)) {
+			if (count < max)
+				handles[count] = e->handle;
+			++count;
+		}
+	return count;
+}
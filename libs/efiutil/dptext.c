@@ -0,0 +1,947 @@
+/*
+ * Device path text representation
+ */
+#include <efi.h>
+#include <efiutil.h>
+
+#define NODE(type, sub_type) ((type) << 8 | (sub_type))
+
+// PNP IDs with a node name of their own
+static const struct {
+	efi_ch16_t *name;
+	efi_u32_t id;
+} pnp_names[] = {
+	{ L"PciRoot",      0x0a03 },
+	{ L"PcieRoot",     0x0a08 },
+	{ L"Floppy",       0x0604 },
+	{ L"Keyboard",     0x0301 },
+	{ L"Serial",       0x0501 },
+	{ L"ParallelPort", 0x0401 },
+};
+
+static const efi_ch16_t uart_parity[] = L"DNEOMS";
+static efi_ch16_t *uart_stop_bits[] = { L"D", L"1", L"1.5", L"2" };
+
+/*
+ * Device path to text
+ *
+ * Everything is formatted by efi_vsnprint straight into the caller's buffer,
+ * or appended directly for single characters and hex bytes. len keeps
+ * counting once it is full so the caller learns the size needed.
+ */
+struct text {
+	efi_ch16_t *buf;
+	efi_size_t size;
+	efi_size_t len;
+};
+
+static void text_print(struct text *t, efi_ch16_t *fmt, ...)
+{
+	efi_size_t avail;
+	va_list ap;
+
+	avail = t->len < t->size ? t->size - t->len : 0;
+	va_start(ap, fmt);
+	t->len += efi_vsnprint(avail ? t->buf + t->len : NULL, avail, fmt, ap);
+	va_end(ap);
+}
+
+// Append one character, terminated the same way text_print leaves the buffer
+static void text_char(struct text *t, efi_ch16_t ch)
+{
+	if (t->len + 1 < t->size) {
+		t->buf[t->len] = ch;
+		t->buf[t->len + 1] = 0;
+	}
+	++t->len;
+}
+
+static void text_hex(struct text *t, efi_u8_t *data, efi_size_t n)
+{
+	static const efi_ch16_t digits[] = L"0123456789abcdef";
+
+	for (efi_size_t i = 0; i < n; ++i) {
+		text_char(t, digits[data[i] >> 4]);
+		text_char(t, digits[data[i] & 0xf]);
+	}
+}
+
+// Strings in nodes are not always terminated within the node
+static void text_str8(struct text *t, char *str, efi_size_t max)
+{
+	for (efi_size_t i = 0; i < max && str[i]; ++i)
+		text_char(t, (unsigned char) str[i]);
+}
+
+static void text_ipv4(struct text *t, efi_u8_t *addr)
+{
+	text_print(t, L"%d.%d.%d.%d", addr[0], addr[1], addr[2], addr[3]);
+}
+
+static void vendor_to_text(struct text *t, efi_ch16_t *name,
+	efi_vendor_device_path_t *node, efi_size_t len)
+{
+	text_print(t, L"%s(%g", name, &node->vendor_guid);
+	if (len > sizeof(*node)) {
+		text_print(t, L",");
+		text_hex(t, (efi_u8_t *) (node + 1), len - sizeof(*node));
+	}
+	text_print(t, L")");
+}
+
+static void acpi_to_text(struct text *t, efi_acpi_device_path_t *node)
+{
+	if ((node->hid & 0xffff) == 0x41d0) {
+		for (efi_size_t i = 0; i < ARRAY_SIZE(pnp_names); ++i)
+			if (node->hid >> 16 == pnp_names[i].id) {
+				text_print(t, L"%s(0x%x)", pnp_names[i].name, node->uid);
+				return;
+			}
+		text_print(t, L"Acpi(PNP%04X,0x%x)", node->hid >> 16, node->uid);
+	} else {
+		text_print(t, L"Acpi(0x%08x,0x%x)", node->hid, node->uid);
+	}
+}
+
+static void harddrive_to_text(struct text *t, efi_harddrive_device_path_t *node)
+{
+	text_print(t, L"HD(%d,", node->partition_number);
+	switch (node->signature_type) {
+	case EFI_SIGNATURE_TYPE_MBR:
+		text_print(t, L"MBR,0x%08x,", *(efi_u32_t *) node->signature);
+		break;
+	case EFI_SIGNATURE_TYPE_GUID:
+		text_print(t, L"GPT,%g,", (efi_guid_t *) node->signature);
+		break;
+	default:
+		text_print(t, L"%d,0,", node->signature_type);
+		break;
+	}
+	text_print(t, L"0x%" EFI_PRIx64 ",0x%" EFI_PRIx64 ")",
+		node->partition_start, node->partition_size);
+}
+
+static void ipv4_to_text(struct text *t, efi_ipv4_device_path_t *node)
+{
+	text_print(t, L"IPv4(");
+	text_ipv4(t, node->remote_address);
+	if (node->remote_port)
+		text_print(t, L":%d", node->remote_port);
+	if (node->protocol == 6)
+		text_print(t, L",TCP,");
+	else if (node->protocol == 17)
+		text_print(t, L",UDP,");
+	else
+		text_print(t, L",0x%x,", node->protocol);
+	text_print(t, node->static_address ? L"Static," : L"DHCP,");
+	text_ipv4(t, node->local_address);
+	if (node->local_port)
+		text_print(t, L":%d", node->local_port);
+	text_print(t, L",");
+	text_ipv4(t, node->gateway_address);
+	text_print(t, L",");
+	text_ipv4(t, node->subnet_mask);
+	text_print(t, L")");
+}
+
+static void uart_to_text(struct text *t, efi_uart_device_path_t *node)
+{
+	text_print(t, L"Uart(%" EFI_PRIu64 ",%d,", node->baud_rate, node->data_bits);
+	if (node->parity < ARRAY_SIZE(uart_parity) - 1)
+		text_print(t, L"%c,", uart_parity[node->parity]);
+	else
+		text_print(t, L"0x%x,", node->parity);
+	if (node->stop_bits < ARRAY_SIZE(uart_stop_bits))
+		text_print(t, L"%s)", uart_stop_bits[node->stop_bits]);
+	else
+		text_print(t, L"0x%x)", node->stop_bits);
+}
+
+static void node_to_text(struct text *t, efi_device_path_protocol_t *node)
+{
+	efi_size_t len = EFI_DP_NODE_LEN(node);
+
+// The node as a type, NULL if it is too short for its structure
+#define NODE_AS(type) (len < sizeof(type) ? NULL : (type *) node)
+
+	switch (NODE(node->type, node->sub_type)) {
+	case NODE(EFI_HARDWARE_DEVICE_PATH, EFI_HARDWARE_PCI_DEVIE_PATH):
+	{
+		efi_pci_device_path_t *pci = NODE_AS(efi_pci_device_path_t);
+		if (!pci)
+			break;
+		text_print(t, L"Pci(0x%x,0x%x)", pci->device, pci->function);
+		return;
+	}
+	case NODE(EFI_HARDWARE_DEVICE_PATH, EFI_HARDWARE_PCCARD_DEVIDE_PATH):
+	{
+		efi_pccard_device_path_t *pccard = NODE_AS(efi_pccard_device_path_t);
+		if (!pccard)
+			break;
+		text_print(t, L"PcCard(0x%x)", pccard->function);
+		return;
+	}
+	case NODE(EFI_HARDWARE_DEVICE_PATH, EFI_HARDWARE_MMAP_DEVICE_PATH):
+	{
+		efi_mmap_device_path_t *mmap = NODE_AS(efi_mmap_device_path_t);
+		if (!mmap)
+			break;
+		text_print(t, L"MemoryMapped(0x%x,0x%" EFI_PRIx64 ",0x%" EFI_PRIx64 ")",
+			mmap->memory_type, mmap->start_address, mmap->end_address);
+		return;
+	}
+	case NODE(EFI_HARDWARE_DEVICE_PATH, EFI_HARDWARE_VENDOR_DEVICE_PATH):
+	{
+		efi_vendor_device_path_t *vendor = NODE_AS(efi_vendor_device_path_t);
+		if (!vendor)
+			break;
+		vendor_to_text(t, L"VenHw", vendor, len);
+		return;
+	}
+	case NODE(EFI_HARDWARE_DEVICE_PATH, EFI_HARDWARE_CONTROLLER_DEVICE_PATH):
+	{
+		efi_controller_device_path_t *ctrl = NODE_AS(efi_controller_device_path_t);
+		if (!ctrl)
+			break;
+		text_print(t, L"Ctrl(0x%x)", ctrl->controller_number);
+		return;
+	}
+	case NODE(EFI_ACPI_DEVICE_PATH, EFI_ACPI_ACPI_DEVICE_PATH):
+	{
+		efi_acpi_device_path_t *acpi = NODE_AS(efi_acpi_device_path_t);
+		if (!acpi)
+			break;
+		acpi_to_text(t, acpi);
+		return;
+	}
+	case NODE(EFI_ACPI_DEVICE_PATH, EFI_ACPI_ADR_DEVICE_PATH):
+	{
+		efi_acpi_adr_device_path_t *adr = NODE_AS(efi_acpi_adr_device_path_t);
+		if (!adr)
+			break;
+		text_print(t, L"AcpiAdr(0x%x)", adr->adr);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_SCSI_DEVICE_PATH):
+	{
+		efi_scsi_device_path_t *scsi = NODE_AS(efi_scsi_device_path_t);
+		if (!scsi)
+			break;
+		text_print(t, L"Scsi(0x%x,0x%x)", scsi->target_id, scsi->lun);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_USB_DEVICE_PATH):
+	{
+		efi_usb_device_path_t *usb = NODE_AS(efi_usb_device_path_t);
+		if (!usb)
+			break;
+		text_print(t, L"USB(0x%x,0x%x)", usb->parent_port, usb->interface);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_VENDOR_DEVICE_PATH):
+	{
+		efi_vendor_device_path_t *vendor = NODE_AS(efi_vendor_device_path_t);
+		if (!vendor)
+			break;
+		vendor_to_text(t, L"VenMsg", vendor, len);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_MAC_DEVICE_PATH):
+	{
+		efi_mac_device_path_t *mac = NODE_AS(efi_mac_device_path_t);
+		if (!mac)
+			break;
+		/* Ethernet and 802.3 have 6 byte addresses, the rest is padding */
+		text_print(t, L"MAC(");
+		text_hex(t, mac->mac_address, mac->if_type <= 1 ? 6 : 32);
+		text_print(t, L",0x%x)", mac->if_type);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_IPV4_DEVICE_PATH):
+	{
+		efi_ipv4_device_path_t *ipv4 = NODE_AS(efi_ipv4_device_path_t);
+		if (!ipv4)
+			break;
+		ipv4_to_text(t, ipv4);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_UART_DEVICE_PATH):
+	{
+		efi_uart_device_path_t *uart = NODE_AS(efi_uart_device_path_t);
+		if (!uart)
+			break;
+		uart_to_text(t, uart);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_SATA_DEVICE_PATH):
+	{
+		efi_sata_device_path_t *sata = NODE_AS(efi_sata_device_path_t);
+		if (!sata)
+			break;
+		text_print(t, L"Sata(0x%x,0x%x,0x%x)",
+			sata->hba_port, sata->port_multiplier_port, sata->lun);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_NVME_DEVICE_PATH):
+	{
+		efi_nvme_device_path_t *nvme = NODE_AS(efi_nvme_device_path_t);
+		if (!nvme)
+			break;
+		/* The EUI-64 is shown most significant byte first */
+		text_print(t, L"NVMe(0x%x,", nvme->namespace_id);
+		for (int i = 7; i >= 0; --i) {
+			text_hex(t, &nvme->eui64[i], 1);
+			text_char(t, i ? L'-' : L')');
+		}
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_URI_DEVICE_PATH):
+	{
+		efi_uri_device_path_t *uri = NODE_AS(efi_uri_device_path_t);
+		if (!uri)
+			break;
+		text_print(t, L"Uri(");
+		text_str8(t, uri->uri, len - sizeof(*uri));
+		text_print(t, L")");
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_SD_DEVICE_PATH):
+	{
+		efi_sd_device_path_t *sd = NODE_AS(efi_sd_device_path_t);
+		if (!sd)
+			break;
+		text_print(t, L"SD(0x%x)", sd->slot_number);
+		return;
+	}
+	case NODE(EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_EMMC_DEVICE_PATH):
+	{
+		efi_sd_device_path_t *emmc = NODE_AS(efi_sd_device_path_t);
+		if (!emmc)
+			break;
+		text_print(t, L"eMMC(0x%x)", emmc->slot_number);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_HARDDRIVE_DEVICE_PATH):
+	{
+		efi_harddrive_device_path_t *hd = NODE_AS(efi_harddrive_device_path_t);
+		if (!hd)
+			break;
+		harddrive_to_text(t, hd);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_CDROM_DEVICE_PATH):
+	{
+		efi_cdrom_device_path_t *cdrom = NODE_AS(efi_cdrom_device_path_t);
+		if (!cdrom)
+			break;
+		text_print(t, L"CDROM(0x%x,0x%" EFI_PRIx64 ",0x%" EFI_PRIx64 ")",
+			cdrom->boot_entry, cdrom->partition_start, cdrom->partition_size);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_VENDOR_DEVICE_PATH):
+	{
+		efi_vendor_device_path_t *vendor = NODE_AS(efi_vendor_device_path_t);
+		if (!vendor)
+			break;
+		vendor_to_text(t, L"VenMedia", vendor, len);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_FILEPATH_DEVICE_PATH):
+	{
+		efi_filepath_device_path_t *file = (efi_filepath_device_path_t *) node;
+		efi_size_t chars = (len - sizeof(efi_device_path_protocol_t)) / sizeof(efi_ch16_t);
+		for (efi_size_t i = 0; i < chars && file->path_name[i]; ++i)
+			text_char(t, file->path_name[i]);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_PROTOCOL_DEVICE_PATH):
+	{
+		efi_media_protocol_device_path_t *media = NODE_AS(efi_media_protocol_device_path_t);
+		if (!media)
+			break;
+		text_print(t, L"Media(%g)", &media->protocol);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_FV_FILE_DEVICE_PATH):
+	{
+		efi_fv_device_path_t *fv = NODE_AS(efi_fv_device_path_t);
+		if (!fv)
+			break;
+		text_print(t, L"FvFile(%g)", &fv->name);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_FV_DEVICE_PATH):
+	{
+		efi_fv_device_path_t *fv = NODE_AS(efi_fv_device_path_t);
+		if (!fv)
+			break;
+		text_print(t, L"Fv(%g)", &fv->name);
+		return;
+	}
+	case NODE(EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_OFFSET_DEVICE_PATH):
+	{
+		efi_offset_device_path_t *offset = NODE_AS(efi_offset_device_path_t);
+		if (!offset)
+			break;
+		text_print(t, L"Offset(0x%" EFI_PRIx64 ",0x%" EFI_PRIx64 ")",
+			offset->start_offset, offset->end_offset);
+		return;
+	}
+	case NODE(EFI_BBS_DEVICE_PATH, EFI_BBS_BBS_DEVICE_PATH):
+	{
+		efi_bbs_device_path_t *bbs = NODE_AS(efi_bbs_device_path_t);
+		if (!bbs)
+			break;
+		text_print(t, L"BBS(0x%x,", bbs->device_type);
+		text_str8(t, bbs->description, len - sizeof(*bbs));
+		text_print(t, L",0x%x)", bbs->status_flag);
+		return;
+	}
+	}
+
+#undef NODE_AS
+
+	/* Generic form for everything else */
+	text_print(t, L"Path(%d,%d,", node->type, node->sub_type);
+	text_hex(t, (efi_u8_t *) (node + 1), len - sizeof(*node));
+	text_print(t, L")");
+}
+
+efi_size_t efi_dp_to_text(efi_device_path_protocol_t *dp, efi_ch16_t *buf, efi_size_t size)
+{
+	struct text t = { buf, size, 0 };
+	efi_bool_t first = true;
+
+	if (size)
+		buf[0] = 0;
+
+	for (; !(EFI_DP_IS_END(dp) && dp->sub_type == EFI_END_ENTIRE_DEVICE_PATH_SUBTYPE);
+			dp = EFI_DP_NEXT_NODE(dp)) {
+		if (EFI_DP_IS_END(dp)) {
+			text_print(&t, L",");
+			first = true;
+			continue;
+		}
+		/* A corrupt length would otherwise loop forever */
+		if (EFI_DP_NODE_LEN(dp) < (int) sizeof(efi_device_path_protocol_t))
+			break;
+		if (!first)
+			text_print(&t, L"/");
+		node_to_text(&t, dp);
+		first = false;
+	}
+
+	return t.len;
+}
+
+/*
+ * Text to device path
+ *
+ * Nodes are parsed straight into a device path builder, arguments are read
+ * in place from the text.
+ */
+struct args {
+	efi_ch16_t *p;
+	efi_ch16_t *end;
+};
+
+static efi_ch16_t *arg_end(struct args *a)
+{
+	efi_ch16_t *p = a->p;
+
+	while (p < a->end && *p != L',')
+		++p;
+	return p;
+}
+
+// Step over the comma after an argument, the last one has none
+static efi_bool_t arg_next(struct args *a, efi_ch16_t *p)
+{
+	if (p < a->end) {
+		if (*p != L',')
+			return false;
+		++p;
+	}
+	a->p = p;
+	return true;
+}
+
+static int hex_digit(efi_ch16_t ch)
+{
+	if (ch >= L'0' && ch <= L'9')
+		return ch - L'0';
+	if (ch >= L'a' && ch <= L'f')
+		return ch - L'a' + 10;
+	if (ch >= L'A' && ch <= L'F')
+		return ch - L'A' + 10;
+	return -1;
+}
+
+// Parse exactly n hex digits
+static efi_bool_t parse_hex(efi_ch16_t *p, int n, efi_u64_t *val)
+{
+	efi_u64_t v = 0;
+	int digit;
+
+	for (int i = 0; i < n; ++i) {
+		digit = hex_digit(p[i]);
+		if (digit < 0)
+			return false;
+		v = v << 4 | digit;
+	}
+
+	*val = v;
+	return true;
+}
+
+// Parse a hexadecimal or decimal number ending at end
+static efi_bool_t parse_num(efi_ch16_t *p, efi_ch16_t *end, efi_u64_t max, efi_u64_t *val)
+{
+	efi_u64_t n = 0;
+	int base = 10, digit;
+
+	if (end - p > 2 && p[0] == L'0' && (p[1] == L'x' || p[1] == L'X')) {
+		base = 16;
+		p += 2;
+	}
+	if (p == end)
+		return false;
+
+	for (; p < end; ++p) {
+		digit = hex_digit(*p);
+		/* digit > max first, max - digit would wrap otherwise */
+		if (digit < 0 || digit >= base || (efi_u64_t) digit > max || n > (max - digit) / base)
+			return false;
+		n = n * base + digit;
+	}
+
+	*val = n;
+	return true;
+}
+
+static efi_bool_t arg_num(struct args *a, efi_u64_t max, efi_u64_t *val)
+{
+	efi_ch16_t *end = arg_end(a);
+
+	return parse_num(a->p, end, max, val) && arg_next(a, end);
+}
+
+// Parse up to max bytes of hex digits
+static efi_bool_t arg_hex(struct args *a, efi_u8_t *buf, efi_size_t max, efi_size_t *n)
+{
+	efi_ch16_t *end = arg_end(a);
+	efi_u64_t val;
+	efi_size_t i;
+
+	if ((end - a->p) % 2 || (efi_size_t) (end - a->p) / 2 > max)
+		return false;
+
+	for (i = 0; a->p < end; ++i, a->p += 2) {
+		if (!parse_hex(a->p, 2, &val))
+			return false;
+		buf[i] = val;
+	}
+
+	*n = i;
+	return arg_next(a, end);
+}
+
+static efi_bool_t arg_guid(struct args *a, efi_guid_t *guid)
+{
+	efi_ch16_t *p = a->p, *end = arg_end(a);
+	efi_u64_t data1, data2, data3, byte;
+
+	/* xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx */
+	if (end - p != 36 || p[8] != L'-' || p[13] != L'-' || p[18] != L'-' || p[23] != L'-')
+		return false;
+	if (!parse_hex(p, 8, &data1) || !parse_hex(p + 9, 4, &data2)
+			|| !parse_hex(p + 14, 4, &data3))
+		return false;
+	guid->data1 = data1;
+	guid->data2 = data2;
+	guid->data3 = data3;
+	for (int i = 0; i < 8; ++i) {
+		if (!parse_hex(p + (i < 2 ? 19 + i * 2 : 20 + i * 2), 2, &byte))
+			return false;
+		guid->data4[i] = byte;
+	}
+
+	return arg_next(a, end);
+}
+
+// Check if the next argument is exactly str, and step over it if it is
+static efi_bool_t arg_is(struct args *a, efi_ch16_t *str)
+{
+	efi_ch16_t *end = arg_end(a);
+	efi_size_t len = efi_strlen(str);
+
+	if ((efi_size_t) (end - a->p) != len || efi_strncmp(a->p, str, len))
+		return false;
+	return arg_next(a, end);
+}
+
+// Parse a.b.c.d with an optional :port
+static efi_bool_t arg_ipv4(struct args *a, efi_u8_t addr[4], efi_u16_t *port)
+{
+	efi_ch16_t *p = a->p, *end = arg_end(a), *q;
+	efi_u64_t val;
+
+	for (int i = 0; i < 4; ++i) {
+		for (q = p; q < end && *q != L'.' && *q != L':'; ++q)
+			;
+		if (!parse_num(p, q, 255, &val) || (i < 3 && (q == end || *q != L'.')))
+			return false;
+		addr[i] = val;
+		p = q + 1;
+	}
+
+	*port = 0;
+	if (q < end) {
+		if (*q != L':' || !parse_num(q + 1, end, 0xffff, &val))
+			return false;
+		*port = val;
+	}
+	return arg_next(a, end);
+}
+
+// The rest of the arguments, as 8-bit characters
+static void *add_str8_node(efi_dp_builder_t *dpb, efi_u8_t type, efi_u8_t sub_type,
+	efi_size_t hdr_size, struct args *a, efi_ch16_t *end)
+{
+	efi_u8_t *node;
+
+	node = efi_dpb_add_node(dpb, type, sub_type, hdr_size + (end - a->p));
+	for (char *s = (char *) node + hdr_size; a->p < end; )
+		*s++ = *a->p++;
+	return node;
+}
+
+static efi_bool_t parse_node(efi_dp_builder_t *dpb, efi_ch16_t *name, efi_size_t name_len,
+	struct args *a)
+{
+	efi_u64_t v1, v2, v3;
+
+#define IS(str) (name_len == sizeof(str) / sizeof(efi_ch16_t) - 1 && \
+	!efi_strncmp(name, str, name_len))
+#define ADD(type, t, sub_type) \
+	((type *) efi_dpb_add_node(dpb, t, sub_type, sizeof(type)))
+
+	for (efi_size_t i = 0; i < ARRAY_SIZE(pnp_names); ++i)
+		if (efi_strlen(pnp_names[i].name) == name_len
+				&& !efi_strncmp(name, pnp_names[i].name, name_len)) {
+			if (!arg_num(a, 0xffffffff, &v1))
+				return false;
+			efi_acpi_device_path_t *acpi = ADD(efi_acpi_device_path_t,
+				EFI_ACPI_DEVICE_PATH, EFI_ACPI_ACPI_DEVICE_PATH);
+			acpi->hid = EFI_PNP_ID(pnp_names[i].id);
+			acpi->uid = v1;
+			return true;
+		}
+
+	if (IS(L"Pci")) {
+		if (!arg_num(a, 0xff, &v1) || !arg_num(a, 0xff, &v2))
+			return false;
+		efi_pci_device_path_t *pci = ADD(efi_pci_device_path_t,
+			EFI_HARDWARE_DEVICE_PATH, EFI_HARDWARE_PCI_DEVIE_PATH);
+		pci->device = v1;
+		pci->function = v2;
+	} else if (IS(L"PcCard")) {
+		if (!arg_num(a, 0xff, &v1))
+			return false;
+		ADD(efi_pccard_device_path_t, EFI_HARDWARE_DEVICE_PATH,
+			EFI_HARDWARE_PCCARD_DEVIDE_PATH)->function = v1;
+	} else if (IS(L"MemoryMapped")) {
+		if (!arg_num(a, 0xffffffff, &v1) || !arg_num(a, -1, &v2)
+				|| !arg_num(a, -1, &v3))
+			return false;
+		efi_mmap_device_path_t *mmap = ADD(efi_mmap_device_path_t,
+			EFI_HARDWARE_DEVICE_PATH, EFI_HARDWARE_MMAP_DEVICE_PATH);
+		mmap->memory_type = v1;
+		mmap->start_address = v2;
+		mmap->end_address = v3;
+	} else if (IS(L"VenHw") || IS(L"VenMsg") || IS(L"VenMedia")) {
+		efi_guid_t guid;
+		efi_size_t data_len;
+		if (!arg_guid(a, &guid))
+			return false;
+		/* Optional vendor data in hex */
+		data_len = (arg_end(a) - a->p) / 2;
+		efi_vendor_device_path_t *vendor = efi_dpb_add_node(dpb,
+			IS(L"VenHw") ? EFI_HARDWARE_DEVICE_PATH :
+			IS(L"VenMsg") ? EFI_MESSAGING_DEVICE_PATH : EFI_MEDIA_DEVICE_PATH,
+			IS(L"VenHw") ? EFI_HARDWARE_VENDOR_DEVICE_PATH :
+			IS(L"VenMsg") ? EFI_MESSAGING_VENDOR_DEVICE_PATH : EFI_MEDIA_VENDOR_DEVICE_PATH,
+			sizeof(*vendor) + data_len);
+		vendor->vendor_guid = guid;
+		if (!arg_hex(a, (efi_u8_t *) (vendor + 1), data_len, &data_len))
+			return false;
+	} else if (IS(L"Ctrl")) {
+		if (!arg_num(a, 0xffffffff, &v1))
+			return false;
+		ADD(efi_controller_device_path_t, EFI_HARDWARE_DEVICE_PATH,
+			EFI_HARDWARE_CONTROLLER_DEVICE_PATH)->controller_number = v1;
+	} else if (IS(L"Acpi")) {
+		efi_ch16_t *end = arg_end(a);
+		if (end - a->p == 7 && !efi_strncmp(a->p, L"PNP", 3)) {
+			/* EISA ID, PNP followed by the product ID in hex */
+			if (!parse_hex(a->p + 3, 4, &v1) || !arg_next(a, end))
+				return false;
+			v1 = EFI_PNP_ID(v1);
+		} else if (!arg_num(a, 0xffffffff, &v1)) {
+			return false;
+		}
+		if (!arg_num(a, 0xffffffff, &v2))
+			return false;
+		efi_acpi_device_path_t *acpi = ADD(efi_acpi_device_path_t,
+			EFI_ACPI_DEVICE_PATH, EFI_ACPI_ACPI_DEVICE_PATH);
+		acpi->hid = v1;
+		acpi->uid = v2;
+	} else if (IS(L"AcpiAdr")) {
+		if (!arg_num(a, 0xffffffff, &v1))
+			return false;
+		ADD(efi_acpi_adr_device_path_t, EFI_ACPI_DEVICE_PATH,
+			EFI_ACPI_ADR_DEVICE_PATH)->adr = v1;
+	} else if (IS(L"Scsi")) {
+		if (!arg_num(a, 0xffff, &v1) || !arg_num(a, 0xffff, &v2))
+			return false;
+		efi_scsi_device_path_t *scsi = ADD(efi_scsi_device_path_t,
+			EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_SCSI_DEVICE_PATH);
+		scsi->target_id = v1;
+		scsi->lun = v2;
+	} else if (IS(L"USB")) {
+		if (!arg_num(a, 0xff, &v1) || !arg_num(a, 0xff, &v2))
+			return false;
+		efi_usb_device_path_t *usb = ADD(efi_usb_device_path_t,
+			EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_USB_DEVICE_PATH);
+		usb->parent_port = v1;
+		usb->interface = v2;
+	} else if (IS(L"MAC")) {
+		efi_mac_device_path_t *mac = ADD(efi_mac_device_path_t,
+			EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_MAC_DEVICE_PATH);
+		efi_size_t n;
+		memset(mac->mac_address, 0, sizeof(mac->mac_address));
+		if (!arg_hex(a, mac->mac_address, sizeof(mac->mac_address), &n)
+				|| !arg_num(a, 0xff, &v1))
+			return false;
+		mac->if_type = v1;
+	} else if (IS(L"IPv4")) {
+		efi_ipv4_device_path_t *ipv4 = ADD(efi_ipv4_device_path_t,
+			EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_IPV4_DEVICE_PATH);
+		efi_u16_t remote_port, local_port, unused;
+		if (!arg_ipv4(a, ipv4->remote_address, &remote_port))
+			return false;
+		ipv4->remote_port = remote_port;
+		if (arg_is(a, L"TCP"))
+			ipv4->protocol = 6;
+		else if (arg_is(a, L"UDP"))
+			ipv4->protocol = 17;
+		else if (arg_num(a, 0xffff, &v1))
+			ipv4->protocol = v1;
+		else
+			return false;
+		if (arg_is(a, L"Static"))
+			ipv4->static_address = 1;
+		else if (arg_is(a, L"DHCP"))
+			ipv4->static_address = 0;
+		else
+			return false;
+		if (!arg_ipv4(a, ipv4->local_address, &local_port)
+				|| !arg_ipv4(a, ipv4->gateway_address, &unused)
+				|| !arg_ipv4(a, ipv4->subnet_mask, &unused))
+			return false;
+		ipv4->local_port = local_port;
+	} else if (IS(L"Uart")) {
+		efi_uart_device_path_t *uart = ADD(efi_uart_device_path_t,
+			EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_UART_DEVICE_PATH);
+		uart->reserved = 0;
+		if (!arg_num(a, -1, &v1) || !arg_num(a, 0xff, &v2))
+			return false;
+		uart->baud_rate = v1;
+		uart->data_bits = v2;
+		efi_ch16_t *end = arg_end(a);
+		if (end - a->p == 1) {
+			for (v3 = 0; uart_parity[v3] && uart_parity[v3] != *a->p; ++v3)
+				;
+			if (!uart_parity[v3] || !arg_next(a, end))
+				return false;
+		} else if (!arg_num(a, 0xff, &v3)) {
+			return false;
+		}
+		uart->parity = v3;
+		for (v3 = 0; v3 < ARRAY_SIZE(uart_stop_bits); ++v3)
+			if (arg_is(a, uart_stop_bits[v3]))
+				break;
+		if (v3 == ARRAY_SIZE(uart_stop_bits) && !arg_num(a, 0xff, &v3))
+			return false;
+		uart->stop_bits = v3;
+	} else if (IS(L"Sata")) {
+		if (!arg_num(a, 0xffff, &v1) || !arg_num(a, 0xffff, &v2)
+				|| !arg_num(a, 0xffff, &v3))
+			return false;
+		efi_sata_device_path_t *sata = ADD(efi_sata_device_path_t,
+			EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_SATA_DEVICE_PATH);
+		sata->hba_port = v1;
+		sata->port_multiplier_port = v2;
+		sata->lun = v3;
+	} else if (IS(L"NVMe")) {
+		efi_nvme_device_path_t *nvme = ADD(efi_nvme_device_path_t,
+			EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_NVME_DEVICE_PATH);
+		if (!arg_num(a, 0xffffffff, &v1))
+			return false;
+		nvme->namespace_id = v1;
+		/* xx-xx-xx-xx-xx-xx-xx-xx, most significant byte first */
+		if (a->end - a->p != 23)
+			return false;
+		for (int i = 0; i < 8; ++i, a->p += 3) {
+			if (!parse_hex(a->p, 2, &v2) || (i < 7 && a->p[2] != L'-'))
+				return false;
+			nvme->eui64[7 - i] = v2;
+		}
+		a->p = a->end;
+	} else if (IS(L"Uri")) {
+		add_str8_node(dpb, EFI_MESSAGING_DEVICE_PATH, EFI_MESSAGING_URI_DEVICE_PATH,
+			sizeof(efi_uri_device_path_t), a, a->end);
+	} else if (IS(L"SD") || IS(L"eMMC")) {
+		if (!arg_num(a, 0xff, &v1))
+			return false;
+		ADD(efi_sd_device_path_t, EFI_MESSAGING_DEVICE_PATH,
+			IS(L"SD") ? EFI_MESSAGING_SD_DEVICE_PATH
+				: EFI_MESSAGING_EMMC_DEVICE_PATH)->slot_number = v1;
+	} else if (IS(L"HD")) {
+		efi_harddrive_device_path_t *hd = ADD(efi_harddrive_device_path_t,
+			EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_HARDDRIVE_DEVICE_PATH);
+		memset(hd->signature, 0, sizeof(hd->signature));
+		if (!arg_num(a, 0xffffffff, &v1))
+			return false;
+		hd->partition_number = v1;
+		if (arg_is(a, L"MBR")) {
+			if (!arg_num(a, 0xffffffff, &v1))
+				return false;
+			hd->mbr_type = EFI_MBR_TYPE_PCAT;
+			hd->signature_type = EFI_SIGNATURE_TYPE_MBR;
+			*(efi_u32_t *) hd->signature = v1;
+		} else if (arg_is(a, L"GPT")) {
+			if (!arg_guid(a, (efi_guid_t *) hd->signature))
+				return false;
+			hd->mbr_type = EFI_MBR_TYPE_GPT;
+			hd->signature_type = EFI_SIGNATURE_TYPE_GUID;
+		} else {
+			if (!arg_num(a, 0xff, &v1) || !arg_num(a, 0, &v2))
+				return false;
+			hd->mbr_type = 0;
+			hd->signature_type = v1;
+		}
+		if (!arg_num(a, -1, &v1) || !arg_num(a, -1, &v2))
+			return false;
+		hd->partition_start = v1;
+		hd->partition_size = v2;
+	} else if (IS(L"CDROM")) {
+		if (!arg_num(a, 0xffffffff, &v1) || !arg_num(a, -1, &v2)
+				|| !arg_num(a, -1, &v3))
+			return false;
+		efi_cdrom_device_path_t *cdrom = ADD(efi_cdrom_device_path_t,
+			EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_CDROM_DEVICE_PATH);
+		cdrom->boot_entry = v1;
+		cdrom->partition_start = v2;
+		cdrom->partition_size = v3;
+	} else if (IS(L"Media")) {
+		if (!arg_guid(a, &ADD(efi_media_protocol_device_path_t,
+				EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_PROTOCOL_DEVICE_PATH)->protocol))
+			return false;
+	} else if (IS(L"FvFile") || IS(L"Fv")) {
+		if (!arg_guid(a, &ADD(efi_fv_device_path_t, EFI_MEDIA_DEVICE_PATH,
+				IS(L"Fv") ? EFI_MEDIA_FV_DEVICE_PATH
+					: EFI_MEDIA_FV_FILE_DEVICE_PATH)->name))
+			return false;
+	} else if (IS(L"Offset")) {
+		if (!arg_num(a, -1, &v1) || !arg_num(a, -1, &v2))
+			return false;
+		efi_offset_device_path_t *offset = ADD(efi_offset_device_path_t,
+			EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_OFFSET_DEVICE_PATH);
+		offset->reserved = 0;
+		offset->start_offset = v1;
+		offset->end_offset = v2;
+	} else if (IS(L"BBS")) {
+		efi_ch16_t *flags;
+		if (!arg_num(a, 0xffff, &v1))
+			return false;
+		/* The description may contain commas, the flags come last */
+		for (flags = a->end; flags > a->p && flags[-1] != L','; --flags)
+			;
+		if (flags == a->p || !parse_num(flags, a->end, 0xffff, &v2))
+			return false;
+		efi_bbs_device_path_t *bbs = add_str8_node(dpb, EFI_BBS_DEVICE_PATH,
+			EFI_BBS_BBS_DEVICE_PATH, sizeof(efi_bbs_device_path_t), a, flags - 1);
+		bbs->device_type = v1;
+		bbs->status_flag = v2;
+		a->p = a->end;
+	} else if (IS(L"Path")) {
+		if (!arg_num(a, 0xff, &v1) || !arg_num(a, 0xff, &v2))
+			return false;
+		efi_size_t max = (a->end - a->p) / 2, data_len;
+		efi_device_path_protocol_t *node = efi_dpb_add_node(dpb, v1, v2,
+			sizeof(*node) + max);
+		if (!arg_hex(a, (efi_u8_t *) (node + 1), max, &data_len))
+			return false;
+	} else {
+		return false;
+	}
+
+#undef ADD
+#undef IS
+
+	/* Anything left over is an error */
+	return a->p == a->end;
+}
+
+efi_device_path_protocol_t *efi_dp_from_text(efi_ch16_t *text)
+{
+	efi_dp_builder_t dpb;
+	efi_ch16_t *p, *name;
+	struct args a;
+
+	/* Binary nodes are rarely more than twice the size of their text */
+	efi_dpb_init(&dpb, efi_strsize(text) * 2);
+
+	for (p = text; *p; ) {
+		name = p;
+		while (*p && *p != L'(' && *p != L'/' && *p != L',')
+			++p;
+
+		if (*p == L'(') {
+			a.p = p + 1;
+			for (a.end = a.p; *a.end && *a.end != L')'; ++a.end)
+				;
+			if (*a.end != L')' || !parse_node(&dpb, name, p - name, &a))
+				goto err;
+			p = a.end + 1;
+		} else if (p > name) {
+			/* Anything without arguments is a file path */
+			efi_filepath_device_path_t *file = efi_dpb_add_node(&dpb,
+				EFI_MEDIA_DEVICE_PATH, EFI_MEDIA_FILEPATH_DEVICE_PATH,
+				sizeof(efi_device_path_protocol_t)
+				+ (p - name + 1) * sizeof(efi_ch16_t));
+			memcpy(file->path_name, name, (p - name) * sizeof(efi_ch16_t));
+			file->path_name[p - name] = 0;
+		} else {
+			goto err;
+		}
+
+		if (*p == L',') {
+			efi_dpb_add_node(&dpb, EFI_END_DEVICE_PATH_TYPE,
+				EFI_END_INSTANCE_DEVICE_PATH_SUBTYPE,
+				sizeof(efi_device_path_protocol_t));
+			++p;
+		} else if (*p == L'/') {
+			++p;
+		} else if (*p) {
+			goto err;
+		}
+	}
+
+	return efi_dpb_finish(&dpb, NULL);
+
+err:
+	efi_dpb_free(&dpb);
+	return NULL;
+}
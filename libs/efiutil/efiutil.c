@@ -3,6 +3,7 @@
  */
 #include <efi.h>
 #include <efiutil.h>
+#include "private.h"
 
 efi_handle_t efi_image_handle;
 efi_system_table_t *efi_st;
@@ -15,11 +16,17 @@ void efi_init(efi_handle_t image_handle, efi_system_table_t *system_table)
 	efi_st = system_table;
 	efi_bs = system_table->boot_services;
 	efi_rt = system_table->runtime_services;
+
+	cpu_init();
+	string_init();
+	crc32_init();
 }
 
 void efi_abort(efi_ch16_t *error_msg, efi_status_t status)
 {
 	efi_print(error_msg);
+	efi_flush();
+	efi_protocol_cache_fini();
 	efi_bs->exit(efi_image_handle, status, 0, NULL);
 
 	/* We can't do much if exit fails */
@@ -33,162 +40,61 @@ void efi_assert(efi_bool_t condition, efi_ch16_t *error_msg)
 		efi_abort(error_msg, EFI_ABORTED);
 }
 
-void *efi_alloc(efi_size_t size)
+efi_status_t efi_exit_boot_services(efi_size_t map_key)
 {
 	efi_status_t status;
-	void *buffer;
-
-	status = efi_bs->allocate_pool(EFI_LOADER_DATA, size, &buffer);
-	if (EFI_ERROR(status))
-		efi_abort(L"Cannot allocate memory!\n", status);
-	return buffer;
-}
-
-void efi_free(void *buffer)
-{
-	efi_bs->free_pool(buffer);
-}
-
-void *efi_realloc(void *oldptr, efi_size_t oldsize, efi_size_t newsize)
-{
-	void *newptr;
-
-	/* Allocate the new region */
-	newptr = efi_alloc(newsize);
-
-	/* Check if is oldptr is NULL */
-	if (oldptr == NULL) {
-		return newptr;
-	}
-
-	/* Copy over the contents from the old to the new region */
-	memcpy(newptr, oldptr, oldsize);
-
-	/* Free the old memory region */
-	efi_free(oldptr);
-
-	/* Return the pointer to the new memory region */
-	return newptr;
-}
-
-efi_ssize_t efi_strcmp(efi_ch16_t *str1, efi_ch16_t *str2)
-{
-    while (*str1 == *str2++) {
-        if (*str1++ == 0) {
-            return 0;
-        }
-    }
-    return *str1 - str2[-1];
-}
-
-efi_size_t efi_strlen(efi_ch16_t *str)
-{
-	efi_ch16_t *p = str;
-	for (; *p; ++p);
-	return p - str;
-}
-
-efi_size_t efi_strsize(efi_ch16_t *str)
-{
-	return (efi_strlen(str) + 1) * sizeof(efi_ch16_t);
-}
-
-// Length of an EFI device path node
-#define dp_node_len(node)  (node->length[0] | (node->length[1] << 8))
-#define dp_next_node(node) ((efi_device_path_protocol_t *) (((efi_u8_t *) node) + dp_node_len(node)))
-#define dp_add_pointer(x, y) (efi_device_path_protocol_t *) ((efi_size_t) x + (efi_size_t) y)
-
-// Determine the length of an EFI device path
-static efi_size_t get_dp_len(efi_device_path_protocol_t *dp)
-{
-	efi_device_path_protocol_t *first;
-
-	first = dp;
-
-	while (dp->type != EFI_END_DEVICE_PATH_TYPE) {
-		dp = dp_next_node(dp);
-	}
-
-	return (efi_size_t) dp - (efi_size_t) first;
-}
-
-static void fill_end_dp_node(efi_device_path_protocol_t *end_dp)
-{
-	end_dp->type = EFI_END_DEVICE_PATH_TYPE;
-	end_dp->sub_type = EFI_END_ENTIRE_DEVICE_PATH_SUBTYPE;
-	end_dp->length[0] = sizeof(efi_device_path_protocol_t);
-	end_dp->length[1] = 0;
-}
 
-static void fill_file_path_dp_node(efi_filepath_device_path_t *node, efi_ch16_t *str, efi_size_t len)
-{
-	node->header.type = EFI_MEDIA_DEVICE_PATH;
-	node->header.sub_type = EFI_MEDIA_FILEPATH_DEVICE_PATH;
-	node->header.length[0] = sizeof(efi_device_path_protocol_t) + len;
-	node->header.length[1] = 0;
-	memcpy(node->path_name, str, len);
-}
-
-efi_device_path_protocol_t *efi_dp_merge(efi_device_path_protocol_t *first, efi_device_path_protocol_t *second)
-{
-	efi_size_t first_len;
-	efi_size_t second_len;
-	efi_device_path_protocol_t *result;
-
-	first_len = get_dp_len(first);
-	second_len = get_dp_len(second);
-
-	result = efi_alloc(first_len + second_len + sizeof(efi_device_path_protocol_t));
-
-	// Copy the contents of the device paths
-	memcpy(result, first, first_len);
-	memcpy(dp_add_pointer(result, first_len), second, second_len);
-
-	// Create the end node for the resulting device path
-	fill_end_dp_node(dp_add_pointer(result, (first_len + second_len)));
-
-	// Return
-	return result;
-}
-
-efi_device_path_protocol_t *efi_dp_append_file_path(efi_device_path_protocol_t *base, efi_ch16_t *file_path)
-{
-	efi_device_path_protocol_t *result;
-	efi_size_t base_len, file_path_len;
-
-	base_len = get_dp_len(base);
-	file_path_len = efi_strsize(file_path);
-
-	result = efi_alloc(base_len + 2 * sizeof(efi_device_path_protocol_t) + file_path_len);
-
-	memcpy(result, base, base_len);
-	fill_file_path_dp_node((efi_filepath_device_path_t *) dp_add_pointer(result, base_len), file_path, file_path_len);
-	fill_end_dp_node(dp_add_pointer(result, (base_len + sizeof(efi_device_path_protocol_t) + file_path_len)));
-
-	return result;
+	/* Nothing can be printed through firmware once this succeeds */
+	efi_flush();
+	status = efi_bs->exit_boot_services(efi_image_handle, map_key);
+	if (!EFI_ERROR(status))
+		log_exit_boot_services();
+	return status;
 }
 
 efi_status_t efi_locate_all_handles(efi_guid_t *protocol, efi_size_t *num_handles, efi_handle_t **out_buffer)
 {
+	efi_locate_search_type_t search_type =
+		protocol ? EFI_LOCATE_BY_PROTOCOL : EFI_LOCATE_ALL_HANDLES;
 #ifdef USE_EFI110
-	return efi_bs->locate_handle_buffer(EFI_LOCATE_BY_PROTOCOL, protocol, NULL, num_handles, out_buffer);
+	efi_status_t status;
+	efi_handle_t *handles;
+
+	status = efi_bs->locate_handle_buffer(search_type, protocol, NULL, num_handles, &handles);
+	if (EFI_ERROR(status))
+		return status;
+
+	/* Hand out a copy owned by efiutil, so efi_free works on it */
+	*out_buffer = efi_alloc(*num_handles * sizeof(efi_handle_t));
+	memcpy(*out_buffer, handles, *num_handles * sizeof(efi_handle_t));
+	efi_bs->free_pool(handles);
+	return status;
 #else
 	efi_status_t status;
+	efi_scratch_mark_t mark;
 	efi_size_t buffer_size;
+	efi_handle_t *handles;
 
+	/* Probe with temporary buffers, only the final copy is kept */
+	mark = efi_scratch_mark();
 	buffer_size = sizeof(efi_handle_t);
 retry:
-	*out_buffer = efi_alloc(buffer_size);
+	handles = efi_scratch_alloc(buffer_size);
 
-	status = efi_bs->locate_handle(EFI_LOCATE_BY_PROTOCOL, protocol, NULL, &buffer_size, *out_buffer);
+	status = efi_bs->locate_handle(search_type, protocol, NULL, &buffer_size, handles);
 	if (status == EFI_BUFFER_TOO_SMALL) {
-		efi_free(*out_buffer);
+		efi_scratch_release(mark);
 		goto retry;
 	}
-	if (EFI_ERROR(status)) {
-		return status;
-	}
+	if (EFI_ERROR(status))
+		goto done;
+
 	*num_handles = buffer_size / sizeof(efi_handle_t);
+	*out_buffer = efi_alloc(buffer_size);
+	memcpy(*out_buffer, handles, buffer_size);
+
+done:
+	efi_scratch_release(mark);
 	return status;
 #endif
 }
@@ -221,7 +127,14 @@ done:
 #endif
 }
 
-efi_status_t efi_get_file_info(efi_file_protocol_t *file, efi_file_info_t **file_info)
+static void *scratch_grow(void *ptr, efi_size_t size)
+{
+	(void) ptr;
+	return efi_scratch_alloc(size);
+}
+
+static efi_status_t get_file_info(efi_file_protocol_t *file, efi_file_info_t **file_info,
+	void *(*grow)(void *, efi_size_t))
 {
 	efi_status_t status;
 	efi_size_t bufsize;
@@ -235,17 +148,28 @@ retry:
 		*file_info);
 
 	if (status == EFI_BUFFER_TOO_SMALL) {
-		*file_info = efi_alloc(bufsize);
+		*file_info = grow(*file_info, bufsize);
 		goto retry;
 	}
 
 	return status;
 }
 
+efi_status_t efi_get_file_info(efi_file_protocol_t *file, efi_file_info_t **file_info)
+{
+	return get_file_info(file, file_info, efi_resize);
+}
+
+efi_status_t efi_scratch_get_file_info(efi_file_protocol_t *file, efi_file_info_t **file_info)
+{
+	return get_file_info(file, file_info, scratch_grow);
+}
+
 efi_status_t efi_read_file(efi_handle_t device_handle, efi_ch16_t *file_path,
 	efi_size_t *out_size, void **out_data)
 {
 	efi_status_t status = EFI_SUCCESS;
+	efi_scratch_mark_t mark = efi_scratch_mark();
 	efi_simple_file_system_protocol_t *file_system = NULL;
 	efi_file_protocol_t *volume_file = NULL, *file = NULL;
 	efi_file_info_t *file_info = NULL;
@@ -262,7 +186,7 @@ efi_status_t efi_read_file(efi_handle_t device_handle, efi_ch16_t *file_path,
 	if (status != EFI_SUCCESS)
 		goto out;
 
-	status = efi_get_file_info(file, &file_info);
+	status = efi_scratch_get_file_info(file, &file_info);
 	if (status != EFI_SUCCESS)
 		goto out;
 
@@ -274,8 +198,7 @@ efi_status_t efi_read_file(efi_handle_t device_handle, efi_ch16_t *file_path,
 		efi_free(*out_data);
 
 out:
-	if (file_info)
-		efi_free(file_info);
+	efi_scratch_release(mark);
 	if (file)
 		file->close(file);
 	if (volume_file)
@@ -0,0 +1,424 @@
+/*
+ * Handle database snapshot
+ */
+#include <efi.h>
+#include <efiutil.h>
+
+#define NONE ((efi_u32_t) -1)
+#define MIN_SLOTS 16
+
+static efi_u32_t hash_guid(efi_guid_t *guid)
+{
+	efi_u32_t *w = (efi_u32_t *) guid;
+
+	return (w[0] ^ w[1] ^ w[2] ^ w[3]) * 0x9e3779b1;
+}
+
+static efi_u32_t hash_handle(efi_handle_t handle)
+{
+	return ((efi_uptr_t) handle >> 3) * 0x9e3779b1;
+}
+
+static void *grow(void *ptr, efi_size_t *cap, efi_size_t need, efi_size_t elem)
+{
+	if (need <= *cap)
+		return ptr;
+	*cap = *cap * 2 > need ? *cap * 2 : need;
+	return efi_resize(ptr, *cap * elem);
+}
+
+static efi_size_t slots_for(efi_size_t n)
+{
+	efi_size_t size;
+
+	for (size = MIN_SLOTS; size < n * 2; size *= 2)
+		;
+	return size;
+}
+
+/*
+ * Both hash tables hold index + 1, so 0 marks an empty slot
+ */
+static efi_u32_t guid_index(efi_handle_db_t *db, efi_guid_t *guid)
+{
+	efi_size_t i;
+	efi_u32_t idx;
+
+	if (!db->guid_slots)
+		return NONE;
+	for (i = hash_guid(guid) & db->guid_mask; (idx = db->guid_slots[i]);
+			i = (i + 1) & db->guid_mask)
+		if (efi_guid_eq(&db->guids[idx - 1], guid))
+			return idx - 1;
+	return NONE;
+}
+
+static efi_u32_t handle_index(efi_handle_db_t *db, efi_handle_t handle)
+{
+	efi_size_t i;
+	efi_u32_t idx;
+
+	if (!db->handle_slots)
+		return NONE;
+	for (i = hash_handle(handle) & db->handle_mask; (idx = db->handle_slots[i]);
+			i = (i + 1) & db->handle_mask)
+		if (db->handles[idx - 1] == handle)
+			return idx - 1;
+	return NONE;
+}
+
+static void hash_guids(efi_handle_db_t *db)
+{
+	efi_size_t size = slots_for(db->num_guids);
+
+	efi_free(db->guid_slots);
+	db->guid_slots = efi_alloc(size * sizeof(efi_u32_t));
+	memset(db->guid_slots, 0, size * sizeof(efi_u32_t));
+	db->guid_mask = size - 1;
+
+	for (efi_u32_t idx = 0; idx < db->num_guids; ++idx) {
+		efi_size_t i = hash_guid(&db->guids[idx]) & db->guid_mask;
+		while (db->guid_slots[i])
+			i = (i + 1) & db->guid_mask;
+		db->guid_slots[i] = idx + 1;
+	}
+}
+
+static void hash_handles(efi_handle_db_t *db)
+{
+	efi_size_t size = slots_for(db->num_handles);
+
+	efi_free(db->handle_slots);
+	db->handle_slots = efi_alloc(size * sizeof(efi_u32_t));
+	memset(db->handle_slots, 0, size * sizeof(efi_u32_t));
+	db->handle_mask = size - 1;
+
+	for (efi_u32_t idx = 0; idx < db->num_handles; ++idx) {
+		efi_size_t i = hash_handle(db->handles[idx]) & db->handle_mask;
+		while (db->handle_slots[i])
+			i = (i + 1) & db->handle_mask;
+		db->handle_slots[i] = idx + 1;
+	}
+}
+
+/* Indices of interned GUIDs never change, so unqueried handles keep theirs */
+static efi_u32_t intern(efi_handle_db_t *db, efi_size_t *cap, efi_guid_t *guid)
+{
+	efi_u32_t idx;
+
+	idx = guid_index(db, guid);
+	if (idx != NONE)
+		return idx;
+
+	db->guids = grow(db->guids, cap, db->num_guids + 1, sizeof(efi_guid_t));
+	db->guids[db->num_guids++] = *guid;
+	if (!db->guid_slots || db->num_guids * 2 > db->guid_mask + 1) {
+		hash_guids(db);
+	} else {
+		efi_size_t i = hash_guid(guid) & db->guid_mask;
+		while (db->guid_slots[i])
+			i = (i + 1) & db->guid_mask;
+		db->guid_slots[i] = db->num_guids;
+	}
+	return db->num_guids - 1;
+}
+
+/* Build the protocol to handles direct from the handle to protocols lists */
+static void invert(efi_handle_db_t *db)
+{
+	efi_u32_t *pos;
+
+	efi_free(db->guid_first);
+	efi_free(db->guid_handles);
+	db->guid_first = efi_alloc((db->num_guids + 1) * sizeof(efi_u32_t));
+	db->guid_handles = efi_alloc((db->handle_first[db->num_handles] + 1)
+		* sizeof(efi_u32_t));
+
+	/* Counting sort, handles stay in ascending order within each protocol */
+	memset(db->guid_first, 0, (db->num_guids + 1) * sizeof(efi_u32_t));
+	for (efi_u32_t i = 0; i < db->handle_first[db->num_handles]; ++i)
+		++db->guid_first[db->handle_guids[i] + 1];
+	for (efi_size_t g = 0; g < db->num_guids; ++g)
+		db->guid_first[g + 1] += db->guid_first[g];
+
+	pos = efi_alloc((db->num_guids + 1) * sizeof(efi_u32_t));
+	memcpy(pos, db->guid_first, (db->num_guids + 1) * sizeof(efi_u32_t));
+	for (efi_u32_t h = 0; h < db->num_handles; ++h)
+		for (efi_u32_t i = db->handle_first[h]; i < db->handle_first[h + 1]; ++i)
+			db->guid_handles[pos[db->handle_guids[i]]++] = h;
+	efi_free(pos);
+}
+
+/* Watch every interned GUID from first on for new installs */
+static void watch(efi_handle_db_t *db, efi_size_t first)
+{
+	db->registrations = efi_resize(db->registrations,
+		(db->num_guids + 1) * sizeof(void *));
+	for (efi_size_t g = first; g < db->num_guids; ++g)
+		if (EFI_ERROR(efi_bs->register_protocol_notify(&db->guids[g],
+				db->event, &db->registrations[g])))
+			db->registrations[g] = NULL;
+}
+
+/*
+ * Rebuild db from its current handles plus extra. Handles in extra, new or
+ * not, are queried again, every other handle keeps its protocol list.
+ */
+static void rebuild(efi_handle_db_t *db, efi_handle_t *extra, efi_size_t num_extra)
+{
+	efi_size_t num_handles, guid_cap, list_cap, num_entries, old_guids, out;
+	efi_handle_t *handles;
+	efi_u32_t *first, *list;
+	efi_u8_t *query;
+
+	/* Merge extra into the handle list, flagging what needs a query */
+	handles = efi_alloc((db->num_handles + num_extra + 1) * sizeof(efi_handle_t));
+	query = efi_alloc(db->num_handles + num_extra + 1);
+	memcpy(handles, db->handles, db->num_handles * sizeof(efi_handle_t));
+	memset(query, 0, db->num_handles + num_extra + 1);
+	num_handles = db->num_handles;
+	for (efi_size_t i = 0; i < num_extra; ++i) {
+		efi_u32_t idx = handle_index(db, extra[i]);
+		if (idx == NONE) {
+			for (idx = db->num_handles; idx < num_handles; ++idx)
+				if (handles[idx] == extra[i])
+					break;
+			if (idx == num_handles)
+				handles[num_handles++] = extra[i];
+		}
+		query[idx] = 1;
+	}
+
+	guid_cap = old_guids = db->num_guids;
+	list_cap = 0;
+	first = efi_alloc((num_handles + 1) * sizeof(efi_u32_t));
+	list = NULL;
+	num_entries = 0;
+
+	/* Handles that are gone or have nothing left on them are dropped */
+	out = 0;
+	for (efi_size_t h = 0; h < num_handles; ++h) {
+		efi_guid_t **guids;
+		efi_size_t count;
+
+		first[out] = num_entries;
+		if (!query[h]) {
+			efi_u32_t *src = db->handle_guids + db->handle_first[h];
+			count = db->handle_first[h + 1] - db->handle_first[h];
+			list = grow(list, &list_cap, num_entries + count, sizeof(efi_u32_t));
+			memcpy(list + num_entries, src, count * sizeof(efi_u32_t));
+			num_entries += count;
+		} else {
+			if (EFI_ERROR(efi_bs->protocols_per_handle(handles[h], &guids, &count)))
+				continue;
+			list = grow(list, &list_cap, num_entries + count, sizeof(efi_u32_t));
+			for (efi_size_t i = 0; i < count; ++i)
+				list[num_entries++] = intern(db, &guid_cap, guids[i]);
+			efi_bs->free_pool(guids);
+		}
+		if (num_entries > first[out])
+			handles[out++] = handles[h];
+	}
+	first[out] = num_entries;
+	efi_free(query);
+
+	efi_free(db->handles);
+	efi_free(db->handle_first);
+	efi_free(db->handle_guids);
+	db->num_handles = out;
+	db->handles = handles;
+	db->handle_first = first;
+	db->handle_guids = list;
+
+	invert(db);
+	hash_handles(db);
+	if (db->event)
+		watch(db, old_guids);
+}
+
+static efi_status_t efiapi notify(efi_event_t event, void *context)
+{
+	(void) event;
+
+	/* Only flag it here, the allocator must not be entered */
+	((efi_handle_db_t *) context)->stale = true;
+	return EFI_SUCCESS;
+}
+
+efi_status_t efi_handle_db_init(efi_handle_db_t *db)
+{
+	efi_handle_t *handles;
+	efi_size_t num_handles;
+	efi_status_t status;
+
+	memset(db, 0, sizeof(*db));
+
+	/* Without the event the snapshot just can't be refreshed incrementally */
+	status = efi_bs->create_event(EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+		notify, db, &db->event);
+	if (EFI_ERROR(status))
+		db->event = NULL;
+
+	status = efi_locate_all_handles(NULL, &num_handles, &handles);
+	if (EFI_ERROR(status)) {
+		efi_handle_db_free(db);
+		return status;
+	}
+
+	rebuild(db, handles, num_handles);
+	efi_free(handles);
+	db->stale = false;
+	return EFI_SUCCESS;
+}
+
+/* Count the handles in the firmware, the buffer only has to hold one */
+static efi_size_t count_handles(void)
+{
+	efi_handle_t handle;
+	efi_size_t size = sizeof(handle);
+	efi_status_t status;
+
+	status = efi_bs->locate_handle(EFI_LOCATE_ALL_HANDLES, NULL, NULL,
+		&size, &handle);
+	if (EFI_ERROR(status) && status != EFI_BUFFER_TOO_SMALL)
+		return 0;
+	return size / sizeof(handle);
+}
+
+efi_status_t efi_handle_db_refresh(efi_handle_db_t *db)
+{
+	efi_handle_t *extra, handle;
+	efi_size_t num_extra, cap;
+
+	if (!db->event)
+		goto rebuild_all;
+
+	if (db->stale) {
+		db->stale = false;
+
+		/* Each registration hands out the handles installed on since last asked */
+		extra = NULL;
+		num_extra = 0;
+		cap = 0;
+		for (efi_size_t g = 0; g < db->num_guids; ++g) {
+			if (!db->registrations[g])
+				continue;
+			for (;;) {
+				efi_size_t size = sizeof(handle);
+				if (EFI_ERROR(efi_bs->locate_handle(EFI_LOCATE_BY_REGISTER_NOTIFY,
+						NULL, db->registrations[g], &size, &handle)))
+					break;
+				extra = grow(extra, &cap, num_extra + 1, sizeof(efi_handle_t));
+				extra[num_extra++] = handle;
+			}
+		}
+
+		if (num_extra)
+			rebuild(db, extra, num_extra);
+		efi_free(extra);
+	}
+
+	/* Handles with only unseen protocols, or gone entirely, were not notified */
+	if (count_handles() == db->num_handles)
+		return EFI_SUCCESS;
+
+rebuild_all:
+	efi_handle_db_free(db);
+	return efi_handle_db_init(db);
+}
+
+void efi_handle_db_free(efi_handle_db_t *db)
+{
+	/* Closing the event drops its registrations too */
+	if (db->event)
+		efi_bs->close_event(db->event);
+	efi_free(db->handles);
+	efi_free(db->guids);
+	efi_free(db->handle_first);
+	efi_free(db->handle_guids);
+	efi_free(db->guid_first);
+	efi_free(db->guid_handles);
+	efi_free(db->handle_slots);
+	efi_free(db->guid_slots);
+	efi_free(db->registrations);
+	memset(db, 0, sizeof(*db));
+}
+
+efi_u32_t *efi_handle_db_by_protocol(efi_handle_db_t *db, efi_guid_t *protocol,
+	efi_size_t *count)
+{
+	efi_u32_t g;
+
+	g = guid_index(db, protocol);
+	if (g == NONE) {
+		*count = 0;
+		return NULL;
+	}
+	*count = db->guid_first[g + 1] - db->guid_first[g];
+	return db->guid_handles + db->guid_first[g];
+}
+
+efi_u32_t *efi_handle_db_protocols(efi_handle_db_t *db, efi_handle_t handle,
+	efi_size_t *count)
+{
+	efi_u32_t h;
+
+	h = handle_index(db, handle);
+	if (h == NONE) {
+		*count = 0;
+		return NULL;
+	}
+	*count = db->handle_first[h + 1] - db->handle_first[h];
+	return db->handle_guids + db->handle_first[h];
+}
+
+static efi_bool_t contains(efi_u32_t *list, efi_size_t count, efi_u32_t val)
+{
+	efi_size_t lo = 0, hi = count;
+
+	while (lo < hi) {
+		efi_size_t mid = lo + (hi - lo) / 2;
+		if (list[mid] < val)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < count && list[lo] == val;
+}
+
+efi_size_t efi_handle_db_by_protocols(efi_handle_db_t *db,
+	efi_guid_t **protocols, efi_size_t num_protocols,
+	efi_u32_t *out, efi_size_t max)
+{
+	efi_u32_t *shortest, *list;
+	efi_size_t shortest_count, count, found;
+
+	if (!num_protocols)
+		return 0;
+
+	/* Walk the shortest list, binary search the others */
+	shortest = efi_handle_db_by_protocol(db, protocols[0], &shortest_count);
+	for (efi_size_t i = 1; i < num_protocols; ++i) {
+		list = efi_handle_db_by_protocol(db, protocols[i], &count);
+		if (count < shortest_count) {
+			shortest = list;
+			shortest_count = count;
+		}
+	}
+
+	found = 0;
+	for (efi_size_t j = 0; j < shortest_count; ++j) {
+		efi_size_t i;
+		for (i = 0; i < num_protocols; ++i) {
+			list = efi_handle_db_by_protocol(db, protocols[i], &count);
+			if (list != shortest && !contains(list, count, shortest[j]))
+				break;
+		}
+		if (i < num_protocols)
+			continue;
+		if (found < max)
+			out[found] = shortest[j];
+		++found;
+	}
+	return found;
+}
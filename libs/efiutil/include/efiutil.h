@@ -14,18 +14,381 @@ extern efi_runtime_services_t *efi_rt;
  */
 void efi_init(efi_handle_t image_handle, efi_system_table_t *system_table);
 
+/*
+ * CPU features, detected by efi_init
+ */
+#define EFI_CPU_SSE2    (1 << 0)
+#define EFI_CPU_SSE41   (1 << 1)
+#define EFI_CPU_SSE42   (1 << 2)
+#define EFI_CPU_PCLMUL  (1 << 3)
+#define EFI_CPU_AVX     (1 << 4)
+#define EFI_CPU_AVX2    (1 << 5)
+#define EFI_CPU_ERMS    (1 << 6)
+#define EFI_CPU_FSRM    (1 << 7)
+
+/*
+ * Execute CPUID, regs receives eax, ebx, ecx and edx
+ */
+void efi_cpuid(efi_u32_t leaf, efi_u32_t subleaf, efi_u32_t regs[4]);
+
+/*
+ * Check if the CPU supports all of features
+ * Vector extensions only count if firmware also enabled their register state
+ */
+efi_bool_t efi_cpu_has(efi_u32_t features);
+
+/*
+ * Read the timestamp counter
+ */
+efi_u64_t efi_rdtsc(void);
+
+/*
+ * Console output is line buffered, it is written out on a newline, when the
+ * buffer fills up, or by efi_flush
+ */
+
+// Write out buffered console output
+void efi_flush(void);
+
 // Print a string
 void efi_puts(efi_ch16_t *str);
 
 // Print a character
 void efi_putchar(efi_ch16_t ch);
 
+/*
+ * Log sinks
+ *
+ * Console output is handed to every attached sink, a line at a time. The
+ * firmware console is attached by default. Sinks that need boot services are
+ * detached by efi_exit_boot_services, the others keep working after it.
+ */
+typedef struct efi_log_sink efi_log_sink_t;
+
+struct efi_log_sink {
+  // Write len characters of str, str is also NUL terminated
+  void (*write)(efi_log_sink_t *sink, efi_ch16_t *str, efi_size_t len);
+  efi_bool_t boot_services;
+  efi_log_sink_t *next;
+};
+
+// Attach a sink, it must stay valid until detached
+void efi_log_attach(efi_log_sink_t *sink);
+
+// Detach a sink
+void efi_log_detach(efi_log_sink_t *sink);
+
+// Get the sink writing to efi_st->con_out
+efi_log_sink_t *efi_log_con_out(void);
+
+/*
+ * Polled 16550 UART, baud 0 keeps the firmware's line settings
+ */
+#define EFI_COM1_PORT 0x3f8
+#define EFI_COM2_PORT 0x2f8
+
+typedef struct {
+  efi_log_sink_t sink;
+  efi_u16_t port;
+  efi_size_t fifo_size;
+} efi_uart_sink_t;
+
+void efi_uart_sink_init(efi_uart_sink_t *uart, efi_u16_t port, efi_u32_t baud);
+
+/*
+ * QEMU debugcon on port 0xe9, returns false if the device is not present
+ */
+efi_bool_t efi_debugcon_sink_init(efi_log_sink_t *sink);
+
+/*
+ * In-memory ring of the most recent output, size is rounded down to a power
+ * of two and must not be zero
+ */
+typedef struct {
+  efi_log_sink_t sink;
+  char *buf;
+  efi_size_t mask;
+  efi_size_t head;
+} efi_ring_sink_t;
+
+void efi_ring_sink_init(efi_ring_sink_t *ring, void *buf, efi_size_t size);
+
+// Copy the last size bytes, or less if not written yet, returns the count
+efi_size_t efi_ring_sink_read(efi_ring_sink_t *ring, char *buf, efi_size_t size);
+
+/*
+ * Persistent boot log
+ *
+ * Log records with timestamps kept in a ring in runtime services data, and
+ * published as a configuration table so they survive handing off to an OS.
+ * Records never wrap around the end of the ring, the gap before the end is
+ * filled by a padding record.
+ */
+#define EFI_BOOT_LOG_GUID \
+  { 0x3ef5cb7d, 0x9aac, 0x4721, { 0xa2, 0x08, 0x47, 0x64, 0x59, 0x38, 0x6e, 0x06 } }
+
+#define EFI_BOOT_LOG_SIGNATURE 0x474f4c5442494645   // "EFIBTLOG"
+#define EFI_BOOT_LOG_VARIABLE L"LibefiBootLog"
+#define EFI_BOOT_LOG_PADDING 0xffffffff
+#define EFI_BOOT_LOG_VARIABLE_MAX 4096              // Fits common firmware limits
+
+typedef struct {
+  efi_u64_t timestamp;      // efi_rdtsc() when written
+  efi_u32_t size;           // Bytes to the next record
+  efi_u32_t length;         // Bytes of text, or EFI_BOOT_LOG_PADDING
+  char text[];              // NUL terminated
+} efi_boot_log_record_t;
+
+typedef struct {
+  efi_u64_t signature;
+  efi_u64_t tsc_frequency;  // Timestamp ticks per second
+  efi_u32_t size;           // Bytes of records
+  efi_u32_t head;           // Offset of the next record
+  efi_u32_t tail;           // Offset of the oldest record
+  efi_u32_t used;           // Bytes from tail to head
+  efi_u8_t records[];
+} efi_boot_log_t;
+
+/*
+ * Allocate a boot log with room for size bytes of records, publish it and
+ * attach it as a log sink
+ */
+efi_status_t efi_boot_log_init(efi_size_t size);
+
+/*
+ * Get the boot log, NULL if not initialized
+ */
+efi_boot_log_t *efi_boot_log(void);
+
+/*
+ * Copy the boot log to the volatile variable EFI_BOOT_LOG_VARIABLE
+ *
+ * Only the records are copied, the oldest are dropped to keep the variable
+ * within max_size bytes. Free space and padding are left out.
+ */
+efi_status_t efi_boot_log_checkpoint(efi_size_t max_size);
+
+/*
+ * Get the record after rec, or the oldest one if rec is NULL
+ * Returns NULL after the newest record
+ */
+efi_boot_log_record_t *efi_boot_log_next(efi_boot_log_t *log,
+  efi_boot_log_record_t *rec);
+
+/*
+ * Formatted output
+ *
+ * Supports printf style flags, widths and length modifiers with the d, i, u,
+ * x, X, o, c and p conversions, s for EFI strings, a for 8-bit strings, and
+ * g/G for printing a GUID pointed to by the argument.
+ *
+ * Newlines are converted to CRLF on the console only.
+ */
+
 // Print formatted string, arguments in ap
 void efi_vprint(efi_ch16_t *fmt, va_list ap);
 
 // Print formatted string
 void efi_print(efi_ch16_t *fmt, ...);
 
+/*
+ * Format into buf, writing at most size characters including the NUL
+ * Returns the length of the complete output, excluding the NUL
+ */
+efi_size_t efi_vsnprint(efi_ch16_t *buf, efi_size_t size, efi_ch16_t *fmt, va_list ap);
+efi_size_t efi_snprint(efi_ch16_t *buf, efi_size_t size, efi_ch16_t *fmt, ...);
+
+/*
+ * Format into a newly allocated string, free it with efi_free
+ */
+efi_ch16_t *efi_vasprint(efi_ch16_t *fmt, va_list ap);
+efi_ch16_t *efi_asprint(efi_ch16_t *fmt, ...);
+
+/*
+ * Format into buf as UTF-8, writing at most size bytes including the NUL
+ * Returns the length in bytes of the complete output, excluding the NUL
+ */
+efi_size_t efi_vsnprint8(char *buf, efi_size_t size, efi_ch16_t *fmt, va_list ap);
+efi_size_t efi_snprint8(char *buf, efi_size_t size, efi_ch16_t *fmt, ...);
+
+/*
+ * Log levels
+ *
+ * Messages above EFI_LOG_LEVEL, set per program at compile time, compile to
+ * nothing. Defining EFI_LOG_LOCATION prefixes messages with the source file
+ * and line, EFI_LOG_TIMESTAMP with efi_rdtsc().
+ */
+#define EFI_LOG_LEVEL_NONE  0
+#define EFI_LOG_LEVEL_ERR   1
+#define EFI_LOG_LEVEL_WARN  2
+#define EFI_LOG_LEVEL_INFO  3
+#define EFI_LOG_LEVEL_DEBUG 4
+
+#ifndef EFI_LOG_LEVEL
+#define EFI_LOG_LEVEL EFI_LOG_LEVEL_INFO
+#endif
+
+#define EFI_LOG_WITH_TIME (1 << 8)
+
+// Print a log message, use the macros below instead
+void efi_log(int flags, const char *file, int line, efi_ch16_t *fmt, ...);
+
+#ifdef EFI_LOG_TIMESTAMP
+#define EFI_LOG_FLAGS EFI_LOG_WITH_TIME
+#else
+#define EFI_LOG_FLAGS 0
+#endif
+
+#ifdef EFI_LOG_LOCATION
+#define EFI_LOG(level, fmt, ...) \
+  efi_log((level) | EFI_LOG_FLAGS, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+#else
+#define EFI_LOG(level, fmt, ...) \
+  efi_log((level) | EFI_LOG_FLAGS, NULL, 0, fmt, ##__VA_ARGS__)
+#endif
+
+#if EFI_LOG_LEVEL >= EFI_LOG_LEVEL_ERR
+#define EFI_LOG_ERR(fmt, ...) EFI_LOG(EFI_LOG_LEVEL_ERR, fmt, ##__VA_ARGS__)
+#else
+#define EFI_LOG_ERR(fmt, ...) ((void) 0)
+#endif
+
+#if EFI_LOG_LEVEL >= EFI_LOG_LEVEL_WARN
+#define EFI_LOG_WARN(fmt, ...) EFI_LOG(EFI_LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define EFI_LOG_WARN(fmt, ...) ((void) 0)
+#endif
+
+#if EFI_LOG_LEVEL >= EFI_LOG_LEVEL_INFO
+#define EFI_LOG_INFO(fmt, ...) EFI_LOG(EFI_LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define EFI_LOG_INFO(fmt, ...) ((void) 0)
+#endif
+
+#if EFI_LOG_LEVEL >= EFI_LOG_LEVEL_DEBUG
+#define EFI_LOG_DEBUG(fmt, ...) EFI_LOG(EFI_LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define EFI_LOG_DEBUG(fmt, ...) ((void) 0)
+#endif
+
+/*
+ * Typed printing
+ *
+ * EFI_PRINT(L"size=", size, L" addr=", ptr) prints each argument with an
+ * emitter picked at compile time from its type, there is no format string to
+ * parse or get wrong. Integers print in decimal, or in hex when wrapped in
+ * EFI_HEX, other pointers print as addresses. GUIDs are passed by pointer,
+ * newlines in EFI strings become CRLF like with efi_print.
+ */
+typedef struct {
+  efi_u64_t val;
+} efi_hex_t;
+
+#define EFI_HEX(x) ((efi_hex_t) { (x) })
+
+void efi_emit_u64(efi_u64_t val);
+void efi_emit_i64(efi_i64_t val);
+void efi_emit_hex(efi_hex_t hex);
+void efi_emit_ptr(const void *ptr);
+void efi_emit_guid(const efi_guid_t *guid);
+void efi_emit_str(const efi_ch16_t *str);
+void efi_emit_str8(const char *str);
+
+#define EFI_EMIT(x) _Generic((x),                                   \
+  efi_ch16_t *: efi_emit_str,       const efi_ch16_t *: efi_emit_str,   \
+  char *: efi_emit_str8,            const char *: efi_emit_str8,        \
+  efi_guid_t *: efi_emit_guid,      const efi_guid_t *: efi_emit_guid,  \
+  efi_hex_t: efi_emit_hex,                                              \
+  _Bool: efi_emit_u64,              char: efi_emit_i64,                 \
+  signed char: efi_emit_i64,        unsigned char: efi_emit_u64,        \
+  short: efi_emit_i64,              unsigned short: efi_emit_u64,       \
+  int: efi_emit_i64,                unsigned int: efi_emit_u64,         \
+  long: efi_emit_i64,               unsigned long: efi_emit_u64,        \
+  long long: efi_emit_i64,          unsigned long long: efi_emit_u64,   \
+  default: efi_emit_ptr)(x);
+
+// Apply m to each of up to 32 arguments
+#define EFI_FOR_EACH(m, ...) \
+  EFI_FE_PICK(__VA_ARGS__, EFI_FE_32, EFI_FE_31, EFI_FE_30, EFI_FE_29, \
+    EFI_FE_28, EFI_FE_27, EFI_FE_26, EFI_FE_25, EFI_FE_24, EFI_FE_23,  \
+    EFI_FE_22, EFI_FE_21, EFI_FE_20, EFI_FE_19, EFI_FE_18, EFI_FE_17,  \
+    EFI_FE_16, EFI_FE_15, EFI_FE_14, EFI_FE_13, EFI_FE_12, EFI_FE_11,  \
+    EFI_FE_10, EFI_FE_9, EFI_FE_8, EFI_FE_7, EFI_FE_6, EFI_FE_5,       \
+    EFI_FE_4, EFI_FE_3, EFI_FE_2, EFI_FE_1)(m, __VA_ARGS__)
+#define EFI_FE_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12,  \
+  _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, \
+  _27, _28, _29, _30, _31, _32, fe, ...) fe
+#define EFI_FE_1(m, x) m(x)
+#define EFI_FE_2(m, x, ...) m(x) EFI_FE_1(m, __VA_ARGS__)
+#define EFI_FE_3(m, x, ...) m(x) EFI_FE_2(m, __VA_ARGS__)
+#define EFI_FE_4(m, x, ...) m(x) EFI_FE_3(m, __VA_ARGS__)
+#define EFI_FE_5(m, x, ...) m(x) EFI_FE_4(m, __VA_ARGS__)
+#define EFI_FE_6(m, x, ...) m(x) EFI_FE_5(m, __VA_ARGS__)
+#define EFI_FE_7(m, x, ...) m(x) EFI_FE_6(m, __VA_ARGS__)
+#define EFI_FE_8(m, x, ...) m(x) EFI_FE_7(m, __VA_ARGS__)
+#define EFI_FE_9(m, x, ...) m(x) EFI_FE_8(m, __VA_ARGS__)
+#define EFI_FE_10(m, x, ...) m(x) EFI_FE_9(m, __VA_ARGS__)
+#define EFI_FE_11(m, x, ...) m(x) EFI_FE_10(m, __VA_ARGS__)
+#define EFI_FE_12(m, x, ...) m(x) EFI_FE_11(m, __VA_ARGS__)
+#define EFI_FE_13(m, x, ...) m(x) EFI_FE_12(m, __VA_ARGS__)
+#define EFI_FE_14(m, x, ...) m(x) EFI_FE_13(m, __VA_ARGS__)
+#define EFI_FE_15(m, x, ...) m(x) EFI_FE_14(m, __VA_ARGS__)
+#define EFI_FE_16(m, x, ...) m(x) EFI_FE_15(m, __VA_ARGS__)
+#define EFI_FE_17(m, x, ...) m(x) EFI_FE_16(m, __VA_ARGS__)
+#define EFI_FE_18(m, x, ...) m(x) EFI_FE_17(m, __VA_ARGS__)
+#define EFI_FE_19(m, x, ...) m(x) EFI_FE_18(m, __VA_ARGS__)
+#define EFI_FE_20(m, x, ...) m(x) EFI_FE_19(m, __VA_ARGS__)
+#define EFI_FE_21(m, x, ...) m(x) EFI_FE_20(m, __VA_ARGS__)
+#define EFI_FE_22(m, x, ...) m(x) EFI_FE_21(m, __VA_ARGS__)
+#define EFI_FE_23(m, x, ...) m(x) EFI_FE_22(m, __VA_ARGS__)
+#define EFI_FE_24(m, x, ...) m(x) EFI_FE_23(m, __VA_ARGS__)
+#define EFI_FE_25(m, x, ...) m(x) EFI_FE_24(m, __VA_ARGS__)
+#define EFI_FE_26(m, x, ...) m(x) EFI_FE_25(m, __VA_ARGS__)
+#define EFI_FE_27(m, x, ...) m(x) EFI_FE_26(m, __VA_ARGS__)
+#define EFI_FE_28(m, x, ...) m(x) EFI_FE_27(m, __VA_ARGS__)
+#define EFI_FE_29(m, x, ...) m(x) EFI_FE_28(m, __VA_ARGS__)
+#define EFI_FE_30(m, x, ...) m(x) EFI_FE_29(m, __VA_ARGS__)
+#define EFI_FE_31(m, x, ...) m(x) EFI_FE_30(m, __VA_ARGS__)
+#define EFI_FE_32(m, x, ...) m(x) EFI_FE_31(m, __VA_ARGS__)
+
+#define EFI_PRINT(...) do { EFI_FOR_EACH(EFI_EMIT, __VA_ARGS__) } while (0)
+
+/*
+ * Hex dumps
+ *
+ * len bytes at addr are printed 16 bytes per row, each row is written out in
+ * one piece. Rows can be prefixed with the offset from addr or the address.
+ */
+#define EFI_HEXDUMP_OFFSET  (1 << 0)  // Prefix rows with the offset
+#define EFI_HEXDUMP_ADDRESS (1 << 1)  // Prefix rows with the address
+#define EFI_HEXDUMP_ASCII   (1 << 2)  // Add a column with printable characters
+#define EFI_HEXDUMP_WIDE    (1 << 3)  // 32 bytes per row
+
+// Print a hex dump
+void efi_hexdump(const void *addr, efi_size_t len, int flags);
+
+// Format a hex dump into buf, like efi_snprint
+efi_size_t efi_snhexdump(efi_ch16_t *buf, efi_size_t size,
+  const void *addr, efi_size_t len, int flags);
+
+/*
+ * CRC32 with the polynomial UEFI uses, working after exit_boot_services too
+ *
+ * Chain calls by passing the previous result as crc, starting from 0.
+ * Slice-by-8 tables are used, or carry-less multiplies where the CPU has them.
+ */
+efi_u32_t efi_crc32_update(efi_u32_t crc, const void *data, efi_size_t len);
+
+// CRC32 of a whole buffer
+efi_u32_t efi_crc32(const void *data, efi_size_t len);
+
+/*
+ * Compare results against calculate_crc32 from boot services, a kernel that
+ * disagrees is dropped. Returns EFI_CRC_ERROR on any mismatch, and
+ * EFI_UNSUPPORTED if the firmware couldn't provide the reference.
+ */
+efi_status_t efi_crc32_self_check(void);
+
 /*
  * Print error_msg, then exit with status
  */
@@ -36,8 +399,17 @@ void efi_abort(efi_ch16_t *error_msg, efi_status_t status);
  */
 void efi_assert(efi_bool_t condition, efi_ch16_t *error_msg);
 
+/*
+ * Flush output and exit boot services, detaching the log sinks that need them
+ */
+efi_status_t efi_exit_boot_services(efi_size_t map_key);
+
 /*
  * Allocate an n byte memory region
+ *
+ * Small regions come from size class free lists backed by page runs, so most
+ * calls never enter firmware. The allocator is not reentrant, don't use it
+ * from event notification functions.
  */
 void *efi_alloc(efi_size_t n);
 
@@ -48,26 +420,242 @@ void efi_free(void *ptr);
 
 /*
  * Resize a memory region from oldsize to newsize
+ * The region is only moved if it cannot be grown in place
  */
 void *efi_realloc(void *oldptr, efi_size_t oldsize, efi_size_t newsize);
 
+/*
+ * Resize a memory region to newsize, the old size is tracked by efiutil
+ */
+void *efi_resize(void *ptr, efi_size_t newsize);
+
+/*
+ * Determine how many bytes the region pointed to by ptr can hold
+ */
+efi_size_t efi_alloc_size(void *ptr);
+
+/*
+ * Allocation statistics, enabled by building with EFIUTIL_ALLOC_STATS
+ *
+ * When enabled, the allocator's pages carry the OEM memory types below, so
+ * they can be told apart from other allocations in the firmware memory map.
+ */
+#define EFI_ALLOC_RUN_MEMORY_TYPE   0x70ef0001
+#define EFI_ALLOC_LARGE_MEMORY_TYPE 0x70ef0002
+
+#ifdef EFI_ALLOC_STATS
+/*
+ * Print allocation totals, a size histogram, per call site totals and
+ * every block that is still live
+ */
+void efi_alloc_report(void);
+#else
+#define efi_alloc_report() ((void) 0)
+#endif
+
+/*
+ * Position in the scratch arena
+ */
+typedef struct {
+  void *chunk;
+  efi_size_t offset;
+} efi_scratch_mark_t;
+
+/*
+ * Remember the current position of the scratch arena
+ */
+efi_scratch_mark_t efi_scratch_mark(void);
+
+/*
+ * Allocate n bytes of temporary memory from the scratch arena
+ * The memory stays valid until a mark taken before it is released
+ */
+void *efi_scratch_alloc(efi_size_t n);
+
+/*
+ * Free everything allocated from the scratch arena since mark was taken
+ */
+void efi_scratch_release(efi_scratch_mark_t mark);
+
+/*
+ * Return every page held by the allocator to firmware
+ * All regions obtained from efi_alloc become invalid, call this before
+ * exit_boot_services when nothing allocated is needed anymore
+ *
+ * The configuration table, SMBIOS and device path indices are reset and
+ * built again by their next lookup. Handle database snapshots are not,
+ * efi_handle_db_free them first. The ACPI index, the protocol cache and
+ * the boot log don't use efi_alloc and stay valid.
+ */
+void efi_free_all(void);
+
+/*
+ * Range of pages obtained from firmware
+ */
+typedef struct {
+  efi_physical_address_t base;
+  efi_size_t pages;
+} efi_pages_t;
+
+/*
+ * Allocate pages for size bytes of memory_type, aligned to align bytes and
+ * ending at or below max_addr (0 for no limit)
+ * Only the pages covering size are kept, none are wasted on alignment
+ */
+efi_status_t efi_alloc_pages(efi_memory_type_t memory_type,
+    efi_physical_address_t max_addr, efi_size_t align, efi_size_t size,
+    efi_pages_t *pages);
+
+/*
+ * Free the exact range of pages returned by efi_alloc_pages
+ */
+void efi_free_pages(efi_pages_t *pages);
+
 /*
  * Compare two EFI strings for equality
  * The return value works similar to strcmp
  */
 efi_ssize_t efi_strcmp(efi_ch16_t *str1, efi_ch16_t *str2);
 
+/*
+ * Compare at most n characters of two EFI strings
+ */
+efi_ssize_t efi_strncmp(efi_ch16_t *str1, efi_ch16_t *str2, efi_size_t n);
+
 /*
  * Determine the length of an EFI string pointed to by str
  */
 efi_size_t efi_strlen(efi_ch16_t *str);
 
+/*
+ * Determine the length of an EFI string, looking at most at max characters
+ */
+efi_size_t efi_strnlen(efi_ch16_t *str, efi_size_t max);
+
 /*
  * Determine how many a bytes an EFI string takes to store
  *  including the null-terminator
  */
 efi_size_t efi_strsize(efi_ch16_t *str);
 
+/*
+ * Device path nodes
+ */
+#define EFI_DP_NODE_LEN(node) ((node)->length[0] | ((node)->length[1] << 8))
+#define EFI_DP_NEXT_NODE(node) \
+  ((efi_device_path_protocol_t *) ((efi_u8_t *) (node) + EFI_DP_NODE_LEN(node)))
+#define EFI_DP_IS_END(node) ((node)->type == EFI_END_DEVICE_PATH_TYPE)
+
+// Iterate over the nodes of the first instance of dp, without the end node
+#define EFI_DP_FOR_EACH(node, dp) \
+  for ((node) = (dp); !EFI_DP_IS_END(node); (node) = EFI_DP_NEXT_NODE(node))
+
+/*
+ * Determine the length in bytes of the first instance of a device path,
+ * excluding the end node
+ */
+efi_size_t efi_dp_len(efi_device_path_protocol_t *dp);
+
+/*
+ * Device path builder
+ *
+ * Nodes are appended to a growable buffer without rescanning what is already
+ * there, the end node is only written by efi_dpb_finish. size_hint reserves
+ * room for that many bytes of nodes up front, so a builder whose final size
+ * is known only allocates once.
+ */
+typedef struct {
+  efi_u8_t *buf;
+  efi_size_t len;           // Bytes of nodes appended so far
+  efi_size_t size;          // Bytes allocated
+} efi_dp_builder_t;
+
+#define EFI_DP_UNKNOWN_LEN ((efi_size_t) -1)
+
+void efi_dpb_init(efi_dp_builder_t *dpb, efi_size_t size_hint);
+
+// Free the buffer of an unfinished builder
+void efi_dpb_free(efi_dp_builder_t *dpb);
+
+// Append a node with len bytes including its header, the caller fills the rest
+void *efi_dpb_add_node(efi_dp_builder_t *dpb, efi_u8_t type, efi_u8_t sub_type,
+  efi_size_t len);
+
+// Append a copy of node
+void efi_dpb_append_node(efi_dp_builder_t *dpb, efi_device_path_protocol_t *node);
+
+// Append the nodes of dp, len is its efi_dp_len or EFI_DP_UNKNOWN_LEN
+void efi_dpb_append_path(efi_dp_builder_t *dpb, efi_device_path_protocol_t *dp,
+  efi_size_t len);
+
+// Append a file path node
+void efi_dpb_append_file_path(efi_dp_builder_t *dpb, efi_ch16_t *file_path);
+
+/*
+ * Terminate the device path and hand it over to the caller, who frees it with
+ * efi_free. size receives its size including the end node, if not NULL.
+ * The builder is left empty.
+ */
+efi_device_path_protocol_t *efi_dpb_finish(efi_dp_builder_t *dpb, efi_size_t *size);
+
+/*
+ * Convert a device path to text, in the format of the UEFI specification
+ * Output is truncated to size characters including the NUL, returns the
+ * length of the complete text excluding the NUL
+ */
+efi_size_t efi_dp_to_text(efi_device_path_protocol_t *dp, efi_ch16_t *buf, efi_size_t size);
+
+/*
+ * Convert text from efi_dp_to_text back to a device path, text without
+ * arguments is taken as a file path. Returns NULL if text is malformed,
+ * free the result with efi_free.
+ */
+efi_device_path_protocol_t *efi_dp_from_text(efi_ch16_t *text);
+
+/*
+ * Device path index
+ *
+ * Maps device paths to the handles they are installed on, without calling
+ * firmware for each query. Every prefix of every path is hashed, so prefix
+ * and child lookups cost the same as exact ones. The index is built on first
+ * use, and rebuilt by the next query after efi_dp_index_invalidate or, once
+ * efi_dp_index_watch was called, after any device path protocol install.
+ */
+
+// Rebuild the index now
+efi_status_t efi_dp_index_refresh(void);
+
+// Rebuild the index whenever a device path protocol gets installed
+efi_status_t efi_dp_index_watch(void);
+
+/*
+ * Stop watching and free the index
+ *
+ * Must be called before the image exits if efi_dp_index_watch was, the
+ * notification would call into unloaded code otherwise.
+ */
+void efi_dp_index_unwatch(void);
+
+// Rebuild the index on the next query, e.g. after uninstalling protocols
+void efi_dp_index_invalidate(void);
+
+// Find the handle with exactly the device path dp, NULL if there is none
+efi_handle_t efi_dp_index_find(efi_device_path_protocol_t *dp);
+
+/*
+ * Find the handle whose device path is the longest prefix of dp, like
+ * locate_device_path. remaining receives the rest of dp after that prefix.
+ */
+efi_handle_t efi_dp_index_find_prefix(efi_device_path_protocol_t *dp,
+  efi_device_path_protocol_t **remaining);
+
+/*
+ * Find the handles whose device paths start with dp and are longer than it
+ * Stores up to max of them in handles, returns how many there are in total
+ */
+efi_size_t efi_dp_index_children(efi_device_path_protocol_t *dp,
+  efi_handle_t *handles, efi_size_t max);
+
 /*
  * Merge two device path instances
  */
@@ -82,22 +670,295 @@ efi_device_path_protocol_t *efi_dp_append_file_path(
     efi_device_path_protocol_t *base, efi_ch16_t *file_path);
 
 /*
- * Locate all EFI handles that support the specified protocol
+ * Locate all EFI handles that support the specified protocol, or every
+ * handle if protocol is NULL
+ * The returned buffer must be freed with efi_free
  */
 efi_status_t efi_locate_all_handles(efi_guid_t *protocol,
     efi_size_t *num_handles, efi_handle_t **out_buffer);
 
+/*
+ * Handle database snapshot
+ *
+ * Lists every handle with the protocols on it once, so queries need no
+ * firmware calls. Handles and protocols are referred to by their index in
+ * handles and guids, index lists are sorted.
+ */
+typedef struct {
+  efi_size_t          num_handles;
+  efi_handle_t        *handles;
+  efi_size_t          num_guids;
+  efi_guid_t          *guids;
+  // Protocols on handle i are handle_guids[handle_first[i] .. handle_first[i + 1]]
+  efi_u32_t           *handle_first;
+  efi_u32_t           *handle_guids;
+  // Handles with protocol i are guid_handles[guid_first[i] .. guid_first[i + 1]]
+  efi_u32_t           *guid_first;
+  efi_u32_t           *guid_handles;
+  // Hash tables of index + 1
+  efi_u32_t           *handle_slots;
+  efi_size_t          handle_mask;
+  efi_u32_t           *guid_slots;
+  efi_size_t          guid_mask;
+  // Notification of installs, one registration per GUID
+  efi_event_t         event;
+  void                **registrations;
+  volatile efi_bool_t stale;
+} efi_handle_db_t;
+
+/*
+ * Take a snapshot of the handle database
+ * db must stay at the same address until efi_handle_db_free
+ */
+efi_status_t efi_handle_db_init(efi_handle_db_t *db);
+
+/*
+ * Bring db up to date with protocols installed or reinstalled since the
+ * last refresh, only the handles concerned are queried again.
+ *
+ * Notifications are only registered for protocols db has seen. Handles that
+ * appear or disappear change the handle count, which makes this take a new
+ * snapshot. Uninstalls from handles that remain can't be seen, and neither
+ * can new protocols on existing handles without a known one installed with
+ * them. Use efi_handle_db_free and efi_handle_db_init after those.
+ */
+efi_status_t efi_handle_db_refresh(efi_handle_db_t *db);
+
+void efi_handle_db_free(efi_handle_db_t *db);
+
+// Handle indices with protocol installed, NULL if there are none
+efi_u32_t *efi_handle_db_by_protocol(efi_handle_db_t *db, efi_guid_t *protocol,
+    efi_size_t *count);
+
+// Protocol indices on handle, NULL if the handle is unknown
+efi_u32_t *efi_handle_db_protocols(efi_handle_db_t *db, efi_handle_t handle,
+    efi_size_t *count);
+
+/*
+ * Find the handles with all of protocols installed, store up to max of their
+ * indices in out, return how many there are in total
+ */
+efi_size_t efi_handle_db_by_protocols(efi_handle_db_t *db,
+    efi_guid_t **protocols, efi_size_t num_protocols,
+    efi_u32_t *out, efi_size_t max);
+
 /*
  * Locate the first instance of a protocol
  */
 efi_status_t efi_locate_protocol(efi_guid_t *protocol, void **iface);
 
+/*
+ * Protocol interface cache
+ *
+ * Opt-in versions of efi_locate_protocol and handle_protocol that remember
+ * their results per protocol until it is installed or reinstalled anywhere.
+ * Uninstalls can't be seen, call efi_protocol_cache_invalidate after them.
+ *
+ * Each protocol looked up registers a notification calling into the image,
+ * so callers must call efi_protocol_cache_fini before returning to the
+ * firmware.
+ */
+efi_status_t efi_locate_protocol_cached(efi_guid_t *protocol, void **iface);
+
+efi_status_t efi_handle_protocol_cached(efi_handle_t handle,
+    efi_guid_t *protocol, void **iface);
+
+// Forget cached interfaces of protocol, or of every protocol if NULL
+void efi_protocol_cache_invalidate(efi_guid_t *protocol);
+
+/*
+ * Close the protocol notifications behind the cache
+ * efi_abort does it too, later lookups start over
+ */
+void efi_protocol_cache_fini(void);
+
+/*
+ * Compare two GUIDs as a pair of 64-bit words
+ */
+static inline efi_bool_t efi_guid_eq(const efi_guid_t *a, const efi_guid_t *b)
+{
+  efi_u64_t x[2], y[2];
+
+  __builtin_memcpy(x, a, sizeof(x));
+  __builtin_memcpy(y, b, sizeof(y));
+  return ((x[0] ^ y[0]) | (x[1] ^ y[1])) == 0;
+}
+
+/*
+ * Configuration table index
+ *
+ * Lookups hash the GUID instead of scanning the table. A changed table
+ * array or entry count is picked up on the next lookup, otherwise call
+ * efi_config_table_refresh after changing the table behind our back.
+ */
+void efi_config_table_refresh(void);
+
+// Find the table installed for guid, NULL if there is none
+void *efi_config_table(efi_guid_t *guid);
+
+// install_configuration_table that keeps the index up to date
+efi_status_t efi_install_configuration_table(efi_guid_t *guid, void *table);
+
+// ACPI RSDP, preferring the ACPI 2.0 entry over the 1.0 one
+void *efi_acpi_rsdp(void);
+
+// SMBIOS entry point, preferring the 64-bit SMBIOS 3 one
+void *efi_smbios_entry_point(void);
+
+/*
+ * ACPI tables
+ */
+#define EFI_ACPI_RSDP_V1_SIZE 20    // Bytes covered by the ACPI 1.0 checksum
+
+typedef struct {
+  char      signature[8];         // "RSD PTR "
+  efi_u8_t  checksum;
+  char      oem_id[6];
+  efi_u8_t  revision;
+  efi_u32_t rsdt_address;
+  // ACPI 2.0 and later
+  efi_u32_t length;
+  efi_u64_t xsdt_address;
+  efi_u8_t  extended_checksum;
+  efi_u8_t  reserved[3];
+} __attribute__((packed)) efi_acpi_rsdp_t;
+
+typedef struct {
+  char      signature[4];
+  efi_u32_t length;               // Including this header
+  efi_u8_t  revision;
+  efi_u8_t  checksum;
+  char      oem_id[6];
+  char      oem_table_id[8];
+  efi_u32_t oem_revision;
+  efi_u32_t creator_id;
+  efi_u32_t creator_revision;
+} __attribute__((packed)) efi_acpi_header_t;
+
+// Only the table pointers of the FADT
+typedef struct {
+  efi_acpi_header_t header;
+  efi_u32_t firmware_ctrl;
+  efi_u32_t dsdt;
+  efi_u8_t  reserved[88];
+  // ACPI 2.0 and later
+  efi_u64_t x_firmware_ctrl;
+  efi_u64_t x_dsdt;
+} __attribute__((packed)) efi_acpi_fadt_t;
+
+#define EFI_ACPI_SIGNATURE(a, b, c, d) \
+  ((efi_u32_t) (a) | (efi_u32_t) (b) << 8 | (efi_u32_t) (c) << 16 | (efi_u32_t) (d) << 24)
+
+#define EFI_ACPI_SIG_FADT EFI_ACPI_SIGNATURE('F', 'A', 'C', 'P')
+#define EFI_ACPI_SIG_FACS EFI_ACPI_SIGNATURE('F', 'A', 'C', 'S')
+#define EFI_ACPI_SIG_DSDT EFI_ACPI_SIGNATURE('D', 'S', 'D', 'T')
+#define EFI_ACPI_SIG_SSDT EFI_ACPI_SIGNATURE('S', 'S', 'D', 'T')
+#define EFI_ACPI_SIG_MADT EFI_ACPI_SIGNATURE('A', 'P', 'I', 'C')
+#define EFI_ACPI_SIG_MCFG EFI_ACPI_SIGNATURE('M', 'C', 'F', 'G')
+#define EFI_ACPI_SIG_HPET EFI_ACPI_SIGNATURE('H', 'P', 'E', 'T')
+
+/*
+ * Check the RSDP and XSDT (or RSDT) checksums and index every table they
+ * list, plus the DSDT and FACS from the FADT. The index lives in static
+ * storage, so once built it can be used after exit_boot_services.
+ * Lookups build it on first use, which has to happen before that.
+ */
+efi_status_t efi_acpi_init(void);
+
+// The RSDP, NULL if there is none or it failed validation
+efi_acpi_rsdp_t *efi_acpi_validated_rsdp(void);
+
+// Find instance number instance of the table with signature, NULL if absent
+efi_acpi_header_t *efi_acpi_table(efi_u32_t signature, efi_size_t instance);
+
+// Number of tables with signature, e.g. SSDTs
+efi_size_t efi_acpi_table_count(efi_u32_t signature);
+
+/*
+ * SMBIOS structures
+ */
+typedef struct {
+  char      anchor[4];            // "_SM_"
+  efi_u8_t  checksum;
+  efi_u8_t  length;
+  efi_u8_t  major_version;
+  efi_u8_t  minor_version;
+  efi_u16_t max_structure_size;
+  efi_u8_t  revision;
+  efi_u8_t  formatted_area[5];
+  char      intermediate_anchor[5]; // "_DMI_"
+  efi_u8_t  intermediate_checksum;
+  efi_u16_t table_length;
+  efi_u32_t table_address;
+  efi_u16_t num_structures;
+  efi_u8_t  bcd_revision;
+} __attribute__((packed)) efi_smbios_entry_point_t;
+
+typedef struct {
+  char      anchor[5];            // "_SM3_"
+  efi_u8_t  checksum;
+  efi_u8_t  length;
+  efi_u8_t  major_version;
+  efi_u8_t  minor_version;
+  efi_u8_t  docrev;
+  efi_u8_t  revision;
+  efi_u8_t  reserved;
+  efi_u32_t table_max_size;
+  efi_u64_t table_address;
+} __attribute__((packed)) efi_smbios3_entry_point_t;
+
+typedef struct {
+  efi_u8_t  type;
+  efi_u8_t  length;               // Of the formatted area, header included
+  efi_u16_t handle;
+} __attribute__((packed)) efi_smbios_header_t;
+
+#define EFI_SMBIOS_TYPE_BIOS            0
+#define EFI_SMBIOS_TYPE_SYSTEM          1
+#define EFI_SMBIOS_TYPE_BASEBOARD       2
+#define EFI_SMBIOS_TYPE_CHASSIS         3
+#define EFI_SMBIOS_TYPE_PROCESSOR       4
+#define EFI_SMBIOS_TYPE_MEMORY_ARRAY    16
+#define EFI_SMBIOS_TYPE_MEMORY_DEVICE   17
+#define EFI_SMBIOS_TYPE_END             127
+
+typedef struct {
+  efi_smbios_header_t *header;
+  char      **strings;            // strings[0] is string number 1
+  efi_size_t num_strings;
+} efi_smbios_structure_t;
+
+/*
+ * Walk the structure table found through the SMBIOS 3 or 2.x entry point
+ * once, indexing structures by type and handle and splitting their strings.
+ * Lookups do this on first use, which needs boot services.
+ */
+efi_status_t efi_smbios_init(void);
+
+// Version of the entry point as major << 8 | minor, 0 without SMBIOS
+efi_u16_t efi_smbios_version(void);
+
+// All structures of type, in table order, NULL if there are none
+efi_smbios_structure_t *efi_smbios_by_type(efi_u8_t type, efi_size_t *count);
+
+// Find the structure with handle, NULL if there is none
+efi_smbios_structure_t *efi_smbios_by_handle(efi_u16_t handle);
+
+// String number n as referenced from the formatted area, NULL if 0 or unset
+char *efi_smbios_string(efi_smbios_structure_t *s, efi_u8_t n);
+
 /*
  * Get the file info struct for file
  */
 efi_status_t efi_get_file_info(efi_file_protocol_t *file,
     efi_file_info_t **file_info);
 
+/*
+ * Get the file info struct for file, allocated from the scratch arena
+ */
+efi_status_t efi_scratch_get_file_info(efi_file_protocol_t *file,
+    efi_file_info_t **file_info);
+
 /*
  * Read a file from a filesytem
  */
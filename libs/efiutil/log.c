@@ -0,0 +1,211 @@
+/*
+ * Log sinks
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+static void con_out_write(efi_log_sink_t *sink, efi_ch16_t *str, efi_size_t len)
+{
+	(void) sink;
+	(void) len;
+	efi_st->con_out->output_string(efi_st->con_out, str);
+}
+
+static efi_log_sink_t con_out_sink = {
+	.write = con_out_write,
+	.boot_services = true,
+};
+
+static efi_log_sink_t *sinks = &con_out_sink;
+
+void efi_log_attach(efi_log_sink_t *sink)
+{
+	efi_log_sink_t **p;
+
+	/* Keep the order sinks were attached in */
+	for (p = &sinks; *p; p = &(*p)->next)
+		if (*p == sink)
+			return;
+	sink->next = NULL;
+	*p = sink;
+}
+
+void efi_log_detach(efi_log_sink_t *sink)
+{
+	for (efi_log_sink_t **p = &sinks; *p; p = &(*p)->next)
+		if (*p == sink) {
+			*p = sink->next;
+			return;
+		}
+}
+
+efi_log_sink_t *efi_log_con_out(void)
+{
+	return &con_out_sink;
+}
+
+void log_write(efi_ch16_t *str, efi_size_t len)
+{
+	for (efi_log_sink_t *sink = sinks; sink; sink = sink->next)
+		sink->write(sink, str, len);
+}
+
+void log_exit_boot_services(void)
+{
+	efi_log_sink_t **p = &sinks;
+
+	while (*p)
+		if ((*p)->boot_services)
+			*p = (*p)->next;
+		else
+			p = &(*p)->next;
+}
+
+/*
+ * Sinks below talk to hardware directly, they only deal in bytes
+ */
+static inline char to_byte(efi_ch16_t ch)
+{
+	return ch < 0x80 ? ch : '?';
+}
+
+static inline void outb(efi_u16_t port, efi_u8_t val)
+{
+	asm volatile ("outb %0, %1" :: "a" (val), "Nd" (port));
+}
+
+static inline efi_u8_t inb(efi_u16_t port)
+{
+	efi_u8_t val;
+	asm volatile ("inb %1, %0" : "=a" (val) : "Nd" (port));
+	return val;
+}
+
+/*
+ * Polled 16550 UART
+ */
+#define UART_THR	0	/* Transmit holding register */
+#define UART_DLL	0	/* Divisor latch, low byte */
+#define UART_IER	1	/* Interrupt enable */
+#define UART_DLM	1	/* Divisor latch, high byte */
+#define UART_FCR	2	/* FIFO control (write) */
+#define UART_IIR	2	/* Interrupt identification (read) */
+#define UART_LCR	3	/* Line control */
+#define UART_MCR	4	/* Modem control */
+#define UART_LSR	5	/* Line status */
+
+#define UART_LSR_THRE	(1 << 5)	/* Transmit FIFO empty */
+#define UART_CLOCK	115200
+
+/* Give up on a UART that doesn't drain, so a missing one can't hang us */
+#define UART_TIMEOUT	100000
+
+static void uart_wait(efi_uart_sink_t *uart)
+{
+	for (efi_u32_t i = 0; i < UART_TIMEOUT; ++i)
+		if (inb(uart->port + UART_LSR) & UART_LSR_THRE)
+			return;
+}
+
+static void uart_write(efi_log_sink_t *sink, efi_ch16_t *str, efi_size_t len)
+{
+	efi_uart_sink_t *uart = (efi_uart_sink_t *) sink;
+
+	/* Once the FIFO is empty a whole burst can be written without polling */
+	while (len) {
+		efi_size_t n = len < uart->fifo_size ? len : uart->fifo_size;
+		uart_wait(uart);
+		for (efi_size_t i = 0; i < n; ++i)
+			outb(uart->port + UART_THR, to_byte(str[i]));
+		str += n;
+		len -= n;
+	}
+}
+
+void efi_uart_sink_init(efi_uart_sink_t *uart, efi_u16_t port, efi_u32_t baud)
+{
+	uart->sink.write = uart_write;
+	uart->sink.boot_services = false;
+	uart->sink.next = NULL;
+	uart->port = port;
+
+	if (baud) {
+		efi_u16_t divisor = UART_CLOCK / baud;
+		outb(port + UART_IER, 0);
+		outb(port + UART_LCR, 0x80);		/* DLAB */
+		outb(port + UART_DLL, divisor);
+		outb(port + UART_DLM, divisor >> 8);
+		outb(port + UART_LCR, 0x03);		/* 8N1 */
+		outb(port + UART_MCR, 0x03);		/* DTR | RTS */
+	}
+
+	/* Enable and clear the FIFOs, only a 16550A reports them as working */
+	outb(port + UART_FCR, 0x07);
+	uart->fifo_size = (inb(port + UART_IIR) & 0xc0) == 0xc0 ? 16 : 1;
+}
+
+/*
+ * QEMU and Bochs debug console
+ */
+#define DEBUGCON_PORT	0xe9
+
+static void debugcon_write(efi_log_sink_t *sink, efi_ch16_t *str, efi_size_t len)
+{
+	(void) sink;
+	for (efi_size_t i = 0; i < len; ++i)
+		outb(DEBUGCON_PORT, to_byte(str[i]));
+}
+
+efi_bool_t efi_debugcon_sink_init(efi_log_sink_t *sink)
+{
+	sink->write = debugcon_write;
+	sink->boot_services = false;
+	sink->next = NULL;
+
+	/* The port reads back its own number when the device is present */
+	return inb(DEBUGCON_PORT) == DEBUGCON_PORT;
+}
+
+/*
+ * In-memory ring
+ *
+ * Writers reserve their range with an atomic add on head, so several of them
+ * never block each other. The oldest bytes are overwritten once it wraps.
+ */
+static void ring_write(efi_log_sink_t *sink, efi_ch16_t *str, efi_size_t len)
+{
+	efi_ring_sink_t *ring = (efi_ring_sink_t *) sink;
+	efi_size_t pos;
+
+	pos = __atomic_fetch_add(&ring->head, len, __ATOMIC_RELAXED);
+	for (efi_size_t i = 0; i < len; ++i)
+		ring->buf[(pos + i) & ring->mask] = to_byte(str[i]);
+}
+
+void efi_ring_sink_init(efi_ring_sink_t *ring, void *buf, efi_size_t size)
+{
+	ring->sink.write = ring_write;
+	ring->sink.boot_services = false;
+	ring->sink.next = NULL;
+	ring->buf = buf;
+	ring->head = 0;
+
+	/* Round down to a power of two so positions wrap with a mask */
+	while (size & (size - 1))
+		size &= size - 1;
+	ring->mask = size - 1;
+}
+
+efi_size_t efi_ring_sink_read(efi_ring_sink_t *ring, char *buf, efi_size_t size)
+{
+	efi_size_t head, len;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	len = head < ring->mask + 1 ? head : ring->mask + 1;
+	if (len > size)
+		len = size;
+	for (efi_size_t i = 0; i < len; ++i)
+		buf[i] = ring->buf[(head - len + i) & ring->mask];
+	return len;
+}
@@ -4,15 +4,134 @@
 
 #include <efi.h>
 #include <efiutil.h>
+#include "private.h"
+
+/*
+ * Console output is collected in a line buffer, and handed to the log sinks
+ * one line at a time
+ */
+#define LINE_SIZE 160
+
+static efi_ch16_t line_buf[LINE_SIZE + 1];
+static size_t line_len;
+
+void efi_flush(void)
+{
+  if (line_len == 0)
+    return;
+
+  line_buf[line_len] = 0;
+  log_write(line_buf, line_len);
+  line_len = 0;
+}
+
+static inline void line_putchar(efi_ch16_t ch)
+{
+  line_buf[line_len++] = ch;
+  if (ch == L'\n' || line_len == LINE_SIZE)
+    efi_flush();
+}
 
 void efi_puts(efi_ch16_t *str)
 {
-  efi_st->con_out->output_string(efi_st->con_out, str);
+  for (; *str; ++str)
+    line_putchar(*str);
 }
 
 void efi_putchar(efi_ch16_t ch)
 {
-  efi_puts((efi_ch16_t[]) {ch, 0});
+  if (ch)
+    line_putchar(ch);
+}
+
+/*
+ * Destination of the formatting engine: the console, a UCS-2 buffer or a
+ * UTF-8 buffer. Buffers are filled up to size - 1 units and NUL terminated,
+ * len keeps counting what the complete output would need.
+ */
+struct out {
+  efi_ch16_t *buf16;
+  char *buf8;
+  size_t size;
+  size_t pos;
+  size_t len;
+  efi_bool_t console;
+  efi_bool_t utf8;              /* Not implied by buf8, it's NULL when counting */
+};
+
+static void out_utf8(struct out *o, const char *seq, size_t n)
+{
+  /* Sequences are never split, once one doesn't fit we stop writing */
+  if (o->pos == o->len && o->len + n < o->size)
+    for (size_t i = 0; i < n; ++i)
+      o->buf8[o->pos++] = seq[i];
+  o->len += n;
+}
+
+static void out_char(struct out *o, efi_ch16_t ch)
+{
+  if (o->console) {
+    if (ch)
+      line_putchar(ch);
+  } else if (o->utf8) {
+    if (ch < 0x80)
+      out_utf8(o, (char[]) { ch }, 1);
+    else if (ch < 0x800)
+      out_utf8(o, (char[]) { 0xc0 | ch >> 6, 0x80 | (ch & 0x3f) }, 2);
+    else
+      out_utf8(o, (char[]) { 0xe0 | ch >> 12, 0x80 | ((ch >> 6) & 0x3f),
+                             0x80 | (ch & 0x3f) }, 3);
+  } else {
+    if (o->len + 1 < o->size)
+      o->buf16[o->pos++] = ch;
+    ++o->len;
+  }
+}
+
+/* 8-bit characters are passed through to UTF-8 output, widened otherwise */
+static void out_char8(struct out *o, char ch)
+{
+  if (o->utf8)
+    out_utf8(o, &ch, 1);
+  else
+    out_char(o, (unsigned char) ch);
+}
+
+static void out_str(struct out *o, efi_ch16_t *str)
+{
+  for (; *str; ++str)
+    out_char(o, *str);
+}
+
+static void out_str8(struct out *o, const char *str)
+{
+  for (; *str; ++str)
+    out_char8(o, *str);
+}
+
+/* Newlines become CRLF on the console only */
+static void out_newline(struct out *o)
+{
+  if (o->console)
+    out_char(o, L'\r');
+  out_char(o, L'\n');
+}
+
+static void out_finish(struct out *o)
+{
+  if (o->utf8 && o->size)
+    o->buf8[o->pos] = 0;
+  else if (o->buf16 && o->size)
+    o->buf16[o->pos] = 0;
+}
+
+/* Write n characters at once, without splitting them across console lines */
+static void out_span(struct out *o, efi_ch16_t *str, size_t n)
+{
+  if (o->console && line_len + n > LINE_SIZE)
+    efi_flush();
+  for (size_t i = 0; i < n; ++i)
+    out_char(o, str[i]);
 }
 
 #define FLAG_LJUST    (1<<0)
@@ -110,60 +229,177 @@ static int read_length(efi_ch16_t **fmt)
       }
 }
 
-static void print_num(int flags, size_t width, int base, uintmax_t num)
+/*
+ * Digits are generated backwards, ending at the pointer passed in, and the
+ * start of the digits is returned
+ */
+
+// Hexadecimal and octal, shift and mask
+static efi_ch16_t *to_pow2(efi_ch16_t *p, uintmax_t num, int shift,
+                           const efi_ch16_t *digits)
+{
+  unsigned mask = (1 << shift) - 1;
+
+  /* Avoid 64-bit shifts on ia32 when the value fits in 32 bits */
+  for (; num > UINT32_MAX; num >>= shift)
+    *--p = digits[num & mask];
+  efi_u32_t num32 = num;
+  do {
+    *--p = digits[num32 & mask];
+    num32 >>= shift;
+  } while (num32);
+  return p;
+}
+
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+// Decimal of a value that fits in 32 bits, two digits at a time
+static efi_ch16_t *u32_to_dec(efi_ch16_t *p, efi_u32_t num)
+{
+  for (; num >= 100; num /= 100) {
+    const char *pair = digit_pairs + num % 100 * 2;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (num >= 10) {
+    *--p = digit_pairs[num * 2 + 1];
+    *--p = digit_pairs[num * 2];
+  } else {
+    *--p = L'0' + num;
+  }
+  return p;
+}
+
+// High 64 bits of a 64x64-bit product
+static inline efi_u64_t mulhi64(efi_u64_t a, efi_u64_t b)
+{
+#ifdef __x86_64__
+  return ((unsigned __int128) a * b) >> 64;
+#else
+  /* Schoolbook from 32x32->64-bit multiplies, ia32 has no wider one */
+  efi_u64_t a_lo = (efi_u32_t) a, a_hi = a >> 32;
+  efi_u64_t b_lo = (efi_u32_t) b, b_hi = b >> 32;
+  efi_u64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+  efi_u64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+  efi_u64_t cross = (lo_lo >> 32) + (efi_u32_t) hi_lo + lo_hi;
+  return hi_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+/*
+ * num / 1000000000 by multiplying with the reciprocal. 10^9 is 2^9 * 5^9,
+ * dropping the factor of two first makes the quotient exact for all 64-bit
+ * inputs with a 64-bit multiplier.
+ */
+static inline efi_u64_t div_1e9(efi_u64_t num)
+{
+  return mulhi64(num >> 9, 0x44b82fa09b5a53) >> 11;
+}
+
+// Decimal, split into 9 digit chunks until the rest fits in 32 bits
+static efi_ch16_t *to_dec(efi_ch16_t *p, uintmax_t num)
+{
+  while (num > UINT32_MAX) {
+    efi_u64_t q = div_1e9(num);
+    efi_ch16_t *chunk = p - 9;
+    p = u32_to_dec(p, num - q * 1000000000);
+    while (p > chunk)
+      *--p = L'0';
+    num = q;
+  }
+  return u32_to_dec(p, num);
+}
+
+static void print_num(struct out *o, int flags, size_t width, int base, uintmax_t num)
 {
   if (flags & FLAG_SIG) {
     if ((intmax_t) num < 0) {
       num = -num;
-      efi_putchar(L'-');
+      out_char(o, L'-');
     } else if (flags & FLAG_PLUS) {
-      efi_putchar(L'+');
+      out_char(o, L'+');
     } else if (flags & FLAG_SPACE) {
-      efi_putchar(L' ');
+      out_char(o, L' ');
     }
   }
 
   if (flags & FLAG_ALTF) {
     if (base == 8) {
-      efi_putchar(L'0');
+      out_char(o, L'0');
     } else if (base == 16) {
-      efi_putchar(L'0');
+      out_char(o, L'0');
       if (flags & FLAG_UPPER) {
-        efi_putchar(L'X');
+        out_char(o, L'X');
       } else {
-        efi_putchar(L'x');
+        out_char(o, L'x');
       }
     }
   }
 
-  efi_ch16_t buf[20], *p = buf;
+  efi_ch16_t buf[24], *end = buf + sizeof buf / sizeof *buf, *p;
 
-  do {
-    *p++ = ((flags & FLAG_UPPER) ? L"0123456789ABCDEF"
-                                 : L"0123456789abcdef")[num % base];
-    num /= base;
-  } while (num > 0);
+  if (base == 10)
+    p = to_dec(end, num);
+  else
+    p = to_pow2(end, num, base == 16 ? 4 : 3,
+                flags & FLAG_UPPER ? L"0123456789ABCDEF" : L"0123456789abcdef");
 
-  size_t actual_width = p - buf;
+  size_t actual_width = end - p;
 
   if (!(flags & FLAG_LJUST)) {
     for (; width > actual_width; --width) {
-      efi_putchar(flags & FLAG_ZERO ? L'0' : L' ');
+      out_char(o, flags & FLAG_ZERO ? L'0' : L' ');
     }
   }
 
-  do {
-    efi_putchar(*--p);
-  } while (p > buf);
+  for (; p < end; ++p) {
+    out_char(o, *p);
+  }
 
   if (flags & FLAG_LJUST) {
     for (; width > actual_width; --width) {
-      efi_putchar(L' ');
+      out_char(o, L' ');
     }
   }
 }
 
-void efi_vprint(efi_ch16_t *fmt, va_list ap)
+static void print_guid(struct out *o, const efi_guid_t *guid, int flags)
+{
+  flags |= FLAG_ZERO;
+  print_num(o, flags, 8, 16, guid->data1);
+  out_char(o, L'-');
+  print_num(o, flags, 4, 16, guid->data2);
+  out_char(o, L'-');
+  print_num(o, flags, 4, 16, guid->data3);
+  out_char(o, L'-');
+  for (int i = 0; i < 8; ++i) {
+    if (i == 2)
+      out_char(o, L'-');
+    print_num(o, flags, 2, 16, guid->data4[i]);
+  }
+}
+
+/* Literal text, with the same newline handling as format strings */
+static void print_text(struct out *o, const efi_ch16_t *str)
+{
+  for (; *str; ++str)
+    if (*str == L'\n')
+      out_newline(o);
+    else if (*str != L'\r')
+      out_char(o, *str);
+}
+
+static void format(struct out *o, efi_ch16_t *fmt, va_list ap)
 {
   for (; *fmt; ++fmt)
     switch (*fmt) {
@@ -177,7 +413,7 @@ void efi_vprint(efi_ch16_t *fmt, va_list ap)
 
       switch (*fmt) {
       case L'%':
-        efi_putchar(L'%');
+        out_char(o, L'%');
         break;
       case L'd':
       case L'i':
@@ -201,16 +437,26 @@ void efi_vprint(efi_ch16_t *fmt, va_list ap)
             base = 8;
           }
 
+          /* Signed arguments must be sign extended, so no ?: here */
           uintmax_t val;
           switch (length) {
           case LENGTH_LONG:
-            val = flags & FLAG_SIG ? va_arg(ap, long) : va_arg(ap, unsigned long);
+            if (flags & FLAG_SIG)
+              val = va_arg(ap, long);
+            else
+              val = va_arg(ap, unsigned long);
             break;
           case LENGTH_LLONG:
-            val = flags & FLAG_SIG ? va_arg(ap, long long) : va_arg(ap, unsigned long long);
+            if (flags & FLAG_SIG)
+              val = va_arg(ap, long long);
+            else
+              val = va_arg(ap, unsigned long long);
             break;
           case LENGTH_SIZET:
-            val = va_arg(ap, size_t);
+            if (flags & FLAG_SIG)
+              val = va_arg(ap, efi_ssize_t);
+            else
+              val = va_arg(ap, size_t);
             break;
           case LENGTH_IMAXT:
             val = va_arg(ap, uintmax_t);
@@ -219,44 +465,36 @@ void efi_vprint(efi_ch16_t *fmt, va_list ap)
             val = va_arg(ap, ptrdiff_t);
             break;
           default:
-            val = flags & FLAG_SIG ? va_arg(ap, int) : va_arg(ap, unsigned int);
+            if (flags & FLAG_SIG)
+              val = va_arg(ap, int);
+            else
+              val = va_arg(ap, unsigned int);
             break;
           }
 
-          print_num(flags, width, base, val);
+          print_num(o, flags, width, base, val);
         }
         break;
       case L's':
-        efi_puts(va_arg(ap, efi_ch16_t *));
+        out_str(o, va_arg(ap, efi_ch16_t *));
+        break;
+      case L'a':
+        out_str8(o, va_arg(ap, const char *));
         break;
       case L'c':
-        efi_putchar(va_arg(ap, int));
+        out_char(o, va_arg(ap, int));
         break;
       case L'p':
-        print_num(FLAG_ALTF, 0, 16, (uintptr_t) va_arg(ap, void *));
+        print_num(o, FLAG_ALTF, 0, 16, (uintptr_t) va_arg(ap, void *));
         break;
       case L'g':
-        {
-          efi_guid_t *guid = va_arg(ap, efi_guid_t *);
-          efi_print(L"%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-            guid->data1, guid->data2, guid->data3,
-            guid->data4[0], guid->data4[1], guid->data4[2],
-            guid->data4[3], guid->data4[4], guid->data4[5],
-            guid->data4[6], guid->data4[7]);
-        }
+        print_guid(o, va_arg(ap, efi_guid_t *), 0);
         break;
       case L'G':
-        {
-          efi_guid_t *guid = va_arg(ap, efi_guid_t *);
-          efi_print(L"%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X",
-            guid->data1, guid->data2, guid->data3,
-            guid->data4[0], guid->data4[1], guid->data4[2],
-            guid->data4[3], guid->data4[4], guid->data4[5],
-            guid->data4[6], guid->data4[7]);
-        }
+        print_guid(o, va_arg(ap, efi_guid_t *), FLAG_UPPER);
         break;
       default:
-        efi_putchar(L'?');
+        out_char(o, L'?');
         break;
       }
       break;
@@ -264,14 +502,20 @@ void efi_vprint(efi_ch16_t *fmt, va_list ap)
     case L'\r':
       break;
     case L'\n':
-      efi_puts(L"\r\n");
+      out_newline(o);
       break;
     default:
-      efi_putchar(*fmt);
+      out_char(o, *fmt);
       break;
     }
 }
 
+void efi_vprint(efi_ch16_t *fmt, va_list ap)
+{
+  struct out o = { .console = true };
+  format(&o, fmt, ap);
+}
+
 void efi_print(efi_ch16_t *fmt, ...)
 {
   va_list ap;
@@ -279,3 +523,215 @@ void efi_print(efi_ch16_t *fmt, ...)
   efi_vprint(fmt, ap);
   va_end(ap);
 }
+
+efi_size_t efi_vsnprint(efi_ch16_t *buf, efi_size_t size, efi_ch16_t *fmt, va_list ap)
+{
+  struct out o = { .buf16 = buf, .size = size };
+  format(&o, fmt, ap);
+  out_finish(&o);
+  return o.len;
+}
+
+efi_size_t efi_snprint(efi_ch16_t *buf, efi_size_t size, efi_ch16_t *fmt, ...)
+{
+  va_list ap;
+  efi_size_t len;
+  va_start(ap, fmt);
+  len = efi_vsnprint(buf, size, fmt, ap);
+  va_end(ap);
+  return len;
+}
+
+efi_ch16_t *efi_vasprint(efi_ch16_t *fmt, va_list ap)
+{
+  va_list aq;
+  efi_size_t size;
+  efi_ch16_t *buf;
+
+  va_copy(aq, ap);
+  size = efi_vsnprint(NULL, 0, fmt, aq) + 1;
+  va_end(aq);
+
+  buf = efi_alloc(size * sizeof(efi_ch16_t));
+  efi_vsnprint(buf, size, fmt, ap);
+  return buf;
+}
+
+efi_ch16_t *efi_asprint(efi_ch16_t *fmt, ...)
+{
+  va_list ap;
+  efi_ch16_t *buf;
+  va_start(ap, fmt);
+  buf = efi_vasprint(fmt, ap);
+  va_end(ap);
+  return buf;
+}
+
+efi_size_t efi_vsnprint8(char *buf, efi_size_t size, efi_ch16_t *fmt, va_list ap)
+{
+  struct out o = { .buf8 = buf, .size = size, .utf8 = true };
+  format(&o, fmt, ap);
+  out_finish(&o);
+  return o.len;
+}
+
+efi_size_t efi_snprint8(char *buf, efi_size_t size, efi_ch16_t *fmt, ...)
+{
+  va_list ap;
+  efi_size_t len;
+  va_start(ap, fmt);
+  len = efi_vsnprint8(buf, size, fmt, ap);
+  va_end(ap);
+  return len;
+}
+
+void efi_log(int flags, const char *file, int line, efi_ch16_t *fmt, ...)
+{
+  struct out o = { .console = true };
+  va_list ap;
+
+  if (flags & EFI_LOG_WITH_TIME) {
+    out_char(&o, L'[');
+    print_num(&o, 0, 0, 10, efi_rdtsc());
+    print_text(&o, L"] ");
+  }
+  if (file) {
+    out_str8(&o, file);
+    out_char(&o, L':');
+    print_num(&o, 0, 0, 10, line);
+    print_text(&o, L": ");
+  }
+  switch (flags & 0xff) {
+  case EFI_LOG_LEVEL_ERR:
+    print_text(&o, L"error: ");
+    break;
+  case EFI_LOG_LEVEL_WARN:
+    print_text(&o, L"warning: ");
+    break;
+  }
+
+  va_start(ap, fmt);
+  format(&o, fmt, ap);
+  va_end(ap);
+}
+
+/*
+ * Emitters behind EFI_PRINT
+ */
+void efi_emit_u64(efi_u64_t val)
+{
+  struct out o = { .console = true };
+  print_num(&o, 0, 0, 10, val);
+}
+
+void efi_emit_i64(efi_i64_t val)
+{
+  struct out o = { .console = true };
+  print_num(&o, FLAG_SIG, 0, 10, val);
+}
+
+void efi_emit_hex(efi_hex_t hex)
+{
+  struct out o = { .console = true };
+  print_num(&o, FLAG_ALTF, 0, 16, hex.val);
+}
+
+void efi_emit_ptr(const void *ptr)
+{
+  struct out o = { .console = true };
+  print_num(&o, FLAG_ALTF, 0, 16, (uintptr_t) ptr);
+}
+
+void efi_emit_guid(const efi_guid_t *guid)
+{
+  struct out o = { .console = true };
+  print_guid(&o, guid, 0);
+}
+
+void efi_emit_str(const efi_ch16_t *str)
+{
+  struct out o = { .console = true };
+  print_text(&o, str);
+}
+
+void efi_emit_str8(const char *str)
+{
+  struct out o = { .console = true };
+  out_str8(&o, str);
+}
+
+/*
+ * Hex dumps, formatted a row at a time
+ */
+#define HEXDUMP_ROW_MAX 32
+
+static const efi_ch16_t hex_digits[] = L"0123456789abcdef";
+
+static void hexdump(struct out *o, const void *addr, efi_size_t len, int flags)
+{
+  const efi_u8_t *data = addr;
+  size_t row_bytes = flags & EFI_HEXDUMP_WIDE ? 32 : 16;
+  /* Address, hex with a gap every 8 bytes, ASCII column and line ending */
+  efi_ch16_t row[2 * sizeof(uintptr_t) + 2 + HEXDUMP_ROW_MAX * 3
+                 + HEXDUMP_ROW_MAX / 8 + HEXDUMP_ROW_MAX + 4];
+
+  for (efi_size_t off = 0; off < len; off += row_bytes) {
+    efi_ch16_t *p = row;
+    size_t n = len - off < row_bytes ? len - off : row_bytes;
+
+    if (flags & (EFI_HEXDUMP_OFFSET | EFI_HEXDUMP_ADDRESS)) {
+      uintptr_t pos = flags & EFI_HEXDUMP_ADDRESS ? (uintptr_t) (data + off) : off;
+      int digits = flags & EFI_HEXDUMP_ADDRESS ? 2 * sizeof(uintptr_t) : 8;
+      for (int i = digits - 1; i >= 0; --i)
+        *p++ = hex_digits[(pos >> (i * 4)) & 0xf];
+      *p++ = L':';
+      *p++ = L' ';
+    }
+
+    /* Keep the ASCII column lined up on a short last row */
+    size_t cols = flags & EFI_HEXDUMP_ASCII ? row_bytes : n;
+    for (size_t i = 0; i < cols; ++i) {
+      if (i && i % 8 == 0)
+        *p++ = L' ';
+      if (i < n) {
+        *p++ = hex_digits[data[off + i] >> 4];
+        *p++ = hex_digits[data[off + i] & 0xf];
+      } else {
+        *p++ = L' ';
+        *p++ = L' ';
+      }
+      *p++ = L' ';
+    }
+
+    if (flags & EFI_HEXDUMP_ASCII) {
+      *p++ = L'|';
+      for (size_t i = 0; i < n; ++i) {
+        efi_u8_t ch = data[off + i];
+        *p++ = ch >= 0x20 && ch < 0x7f ? ch : L'.';
+      }
+      *p++ = L'|';
+    } else {
+      --p;  /* Trailing space */
+    }
+
+    if (o->console)
+      *p++ = L'\r';
+    *p++ = L'\n';
+    out_span(o, row, p - row);
+  }
+}
+
+void efi_hexdump(const void *addr, efi_size_t len, int flags)
+{
+  struct out o = { .console = true };
+  hexdump(&o, addr, len, flags);
+}
+
+efi_size_t efi_snhexdump(efi_ch16_t *buf, efi_size_t size,
+                         const void *addr, efi_size_t len, int flags)
+{
+  struct out o = { .buf16 = buf, .size = size };
+  hexdump(&o, addr, len, flags);
+  out_finish(&o);
+  return o.len;
+}
@@ -0,0 +1,65 @@
+/*
+ * Interfaces shared between the source files of efiutil
+ */
+#ifndef EFIUTIL_PRIVATE_H
+#define EFIUTIL_PRIVATE_H
+
+/*
+ * Detect the features of the CPU we are running on
+ */
+void cpu_init(void);
+
+/*
+ * Kernels for bulk copies, fills and compares
+ */
+struct bulk_ops {
+	void (*copy)(void *dest, const void *src, size_t n);
+	void (*fill)(void *s, int c, size_t n);
+	int (*cmp)(const void *s1, const void *s2, size_t n);
+};
+
+/*
+ * Get the best vector kernels usable on this CPU, NULL if there are none
+ */
+const struct bulk_ops *simd_init(void);
+
+/*
+ * CRC32 kernel working on the raw CRC register, for len a multiple of 16
+ * and at least 64
+ */
+typedef efi_u32_t (*crc32_kernel_t)(efi_u32_t crc, const unsigned char *p, size_t len);
+
+/*
+ * Get a CRC32 kernel using carry-less multiplies, NULL if there is none
+ */
+crc32_kernel_t simd_crc32_init(void);
+
+/*
+ * Build the CRC32 tables and pick a kernel
+ */
+void crc32_init(void);
+
+/*
+ * Pick the string function implementations best suited for this CPU
+ */
+void string_init(void);
+
+/*
+ * Forget indices kept in efi_alloc memory, for efi_free_all
+ * Their next lookup builds them again
+ */
+void config_reset(void);
+void smbios_reset(void);
+void dp_index_reset(void);
+
+/*
+ * Hand a NUL terminated line of output to all log sinks
+ */
+void log_write(efi_ch16_t *str, efi_size_t len);
+
+/*
+ * Detach the log sinks that depend on boot services
+ */
+void log_exit_boot_services(void);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Protocol interface cache
+ */
+#include <efi.h>
+#include <efiutil.h>
+
+/*
+ * Each cached GUID gets a protocol notification, installs and reinstalls of
+ * that GUID mark its entries stale. Uninstalls are not notified, callers
+ * uninstalling protocols use efi_protocol_cache_invalidate. The events call
+ * back into this image, so efi_protocol_cache_fini must close them before it
+ * returns to the firmware.
+ */
+#define MAX_PROTOCOLS 32
+#define HANDLE_SLOTS 16
+
+struct cached_handle {
+	efi_handle_t handle;
+	void *iface;
+};
+
+struct cached_protocol {
+	efi_guid_t guid;
+	efi_event_t event;
+	volatile efi_bool_t stale;
+	void *iface;				/* Singleton, NULL if not cached */
+	struct cached_handle handles[HANDLE_SLOTS];
+};
+
+/* Fixed, so notify functions never see it move */
+static struct cached_protocol protocols[MAX_PROTOCOLS];
+static efi_size_t num_protocols;
+
+static void clear_protocol(struct cached_protocol *p)
+{
+	p->stale = false;
+	p->iface = NULL;
+	memset(p->handles, 0, sizeof(p->handles));
+}
+
+static efi_status_t efiapi notify(efi_event_t event, void *context)
+{
+	(void) event;
+
+	((struct cached_protocol *) context)->stale = true;
+	return EFI_SUCCESS;
+}
+
+/* Find the entry for protocol, creating it if needed, NULL if uncacheable */
+static struct cached_protocol *get_protocol(efi_guid_t *protocol)
+{
+	struct cached_protocol *p;
+	efi_event_t event;
+	void *registration;
+
+	for (efi_size_t i = 0; i < num_protocols; ++i)
+		if (efi_guid_eq(&protocols[i].guid, protocol)) {
+			p = &protocols[i];
+			if (p->stale)
+				clear_protocol(p);
+			return p;
+		}
+
+	if (num_protocols == MAX_PROTOCOLS)
+		return NULL;
+	p = &protocols[num_protocols];
+	p->guid = *protocol;
+	clear_protocol(p);
+
+	/* Without notifications entries could go stale unseen */
+	if (EFI_ERROR(efi_bs->create_event(EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+			notify, p, &event)))
+		return NULL;
+	if (EFI_ERROR(efi_bs->register_protocol_notify(protocol, event, &registration))) {
+		efi_bs->close_event(event);
+		return NULL;
+	}
+
+	p->event = event;
+	++num_protocols;
+	return p;
+}
+
+efi_status_t efi_locate_protocol_cached(efi_guid_t *protocol, void **iface)
+{
+	struct cached_protocol *p;
+	efi_status_t status;
+
+	p = get_protocol(protocol);
+	if (p && p->iface) {
+		*iface = p->iface;
+		return EFI_SUCCESS;
+	}
+
+	status = efi_locate_protocol(protocol, iface);
+	if (p && !EFI_ERROR(status))
+		p->iface = *iface;
+	return status;
+}
+
+efi_status_t efi_handle_protocol_cached(efi_handle_t handle,
+	efi_guid_t *protocol, void **iface)
+{
+	struct cached_protocol *p;
+	struct cached_handle *slot;
+	efi_status_t status;
+
+	p = get_protocol(protocol);
+	if (!p)
+		return efi_bs->handle_protocol(handle, protocol, iface);
+
+	/* Direct mapped, handles are pool allocations so drop the low bits */
+	slot = &p->handles[((efi_uptr_t) handle >> 4) % HANDLE_SLOTS];
+	if (slot->handle == handle) {
+		*iface = slot->iface;
+		return EFI_SUCCESS;
+	}
+
+	status = efi_bs->handle_protocol(handle, protocol, iface);
+	if (!EFI_ERROR(status)) {
+		slot->handle = handle;
+		slot->iface = *iface;
+	}
+	return status;
+}
+
+void efi_protocol_cache_invalidate(efi_guid_t *protocol)
+{
+	for (efi_size_t i = 0; i < num_protocols; ++i)
+		if (!protocol || efi_guid_eq(&protocols[i].guid, protocol))
+			clear_protocol(&protocols[i]);
+}
+
+void efi_protocol_cache_fini(void)
+{
+	for (efi_size_t i = 0; i < num_protocols; ++i) {
+		efi_bs->close_event(protocols[i].event);
+		clear_protocol(&protocols[i]);
+	}
+	num_protocols = 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * SSE2 and AVX2 kernels for bulk copies, fills and compares
+ *
+ * The rest of efiutil is built for general registers only. Functions here
+ * opt into vector registers one by one with target attributes, and are only
+ * ever called after efi_init confirmed the CPU and firmware support them.
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+typedef char v16_t __attribute__((vector_size(16), may_alias));
+typedef char uv16_t __attribute__((vector_size(16), may_alias, aligned(1)));
+typedef char v32_t __attribute__((vector_size(32), may_alias));
+typedef char uv32_t __attribute__((vector_size(32), may_alias, aligned(1)));
+
+/*
+ * The copy kernels move forward and load each block before storing it, so
+ * they are safe for overlapping regions with dest below src
+ */
+
+__attribute__((target("sse2")))
+static void sse2_copy(void *dest, const void *src, size_t n)
+{
+	unsigned char *d = dest;
+	const unsigned char *s = src;
+
+	for (; n && ((uintptr_t) d & 15); --n)
+		*d++ = *s++;
+
+	for (; n >= 64; n -= 64, d += 64, s += 64) {
+		v16_t a = ((const uv16_t *) s)[0];
+		v16_t b = ((const uv16_t *) s)[1];
+		v16_t c = ((const uv16_t *) s)[2];
+		v16_t e = ((const uv16_t *) s)[3];
+		((v16_t *) d)[0] = a;
+		((v16_t *) d)[1] = b;
+		((v16_t *) d)[2] = c;
+		((v16_t *) d)[3] = e;
+	}
+	for (; n >= 16; n -= 16, d += 16, s += 16)
+		*(v16_t *) d = *(const uv16_t *) s;
+
+	for (; n; --n)
+		*d++ = *s++;
+}
+
+__attribute__((target("sse2")))
+static void sse2_fill(void *s, int c, size_t n)
+{
+	unsigned char *p = s;
+	v16_t v = (v16_t) {} + (char) c;
+
+	for (; n && ((uintptr_t) p & 15); --n)
+		*p++ = c;
+
+	for (; n >= 64; n -= 64, p += 64) {
+		((v16_t *) p)[0] = v;
+		((v16_t *) p)[1] = v;
+		((v16_t *) p)[2] = v;
+		((v16_t *) p)[3] = v;
+	}
+	for (; n >= 16; n -= 16, p += 16)
+		*(v16_t *) p = v;
+
+	for (; n; --n)
+		*p++ = c;
+}
+
+__attribute__((target("sse2")))
+static int sse2_cmp(const void *s1, const void *s2, size_t n)
+{
+	const unsigned char *p1 = s1, *p2 = s2;
+	unsigned mask;
+
+	for (; n >= 16; n -= 16, p1 += 16, p2 += 16) {
+		mask = __builtin_ia32_pmovmskb128(
+			__builtin_ia32_pcmpeqb128(*(const uv16_t *) p1, *(const uv16_t *) p2));
+		if (mask != 0xffff) {
+			mask = __builtin_ctz(~mask);
+			return p1[mask] - p2[mask];
+		}
+	}
+
+	for (; n; --n, ++p1, ++p2)
+		if (*p1 != *p2)
+			return *p1 - *p2;
+
+	return 0;
+}
+
+__attribute__((target("avx2")))
+static void avx2_copy(void *dest, const void *src, size_t n)
+{
+	unsigned char *d = dest;
+	const unsigned char *s = src;
+
+	for (; n && ((uintptr_t) d & 31); --n)
+		*d++ = *s++;
+
+	for (; n >= 128; n -= 128, d += 128, s += 128) {
+		v32_t a = ((const uv32_t *) s)[0];
+		v32_t b = ((const uv32_t *) s)[1];
+		v32_t c = ((const uv32_t *) s)[2];
+		v32_t e = ((const uv32_t *) s)[3];
+		((v32_t *) d)[0] = a;
+		((v32_t *) d)[1] = b;
+		((v32_t *) d)[2] = c;
+		((v32_t *) d)[3] = e;
+	}
+	for (; n >= 32; n -= 32, d += 32, s += 32)
+		*(v32_t *) d = *(const uv32_t *) s;
+
+	for (; n; --n)
+		*d++ = *s++;
+}
+
+__attribute__((target("avx2")))
+static void avx2_fill(void *s, int c, size_t n)
+{
+	unsigned char *p = s;
+	v32_t v = (v32_t) {} + (char) c;
+
+	for (; n && ((uintptr_t) p & 31); --n)
+		*p++ = c;
+
+	for (; n >= 128; n -= 128, p += 128) {
+		((v32_t *) p)[0] = v;
+		((v32_t *) p)[1] = v;
+		((v32_t *) p)[2] = v;
+		((v32_t *) p)[3] = v;
+	}
+	for (; n >= 32; n -= 32, p += 32)
+		*(v32_t *) p = v;
+
+	for (; n; --n)
+		*p++ = c;
+}
+
+__attribute__((target("avx2")))
+static int avx2_cmp(const void *s1, const void *s2, size_t n)
+{
+	const unsigned char *p1 = s1, *p2 = s2;
+	unsigned mask;
+
+	for (; n >= 32; n -= 32, p1 += 32, p2 += 32) {
+		mask = __builtin_ia32_pmovmskb256(
+			__builtin_ia32_pcmpeqb256(*(const uv32_t *) p1, *(const uv32_t *) p2));
+		if (mask != 0xffffffff) {
+			mask = __builtin_ctz(~mask);
+			return p1[mask] - p2[mask];
+		}
+	}
+
+	for (; n; --n, ++p1, ++p2)
+		if (*p1 != *p2)
+			return *p1 - *p2;
+
+	return 0;
+}
+
+static const struct bulk_ops sse2_ops = {
+	.copy = sse2_copy,
+	.fill = sse2_fill,
+	.cmp = sse2_cmp,
+};
+
+static const struct bulk_ops avx2_ops = {
+	.copy = avx2_copy,
+	.fill = avx2_fill,
+	.cmp = avx2_cmp,
+};
+
+const struct bulk_ops *simd_init(void)
+{
+	if (efi_cpu_has(EFI_CPU_AVX2))
+		return &avx2_ops;
+	if (efi_cpu_has(EFI_CPU_SSE2))
+		return &sse2_ops;
+	return NULL;
+}
+
+/*
+ * CRC32 by folding with carry-less multiplies, see Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ * Works on the raw CRC register, len is a multiple of 16 and at least 64.
+ */
+typedef long long v2di_t __attribute__((vector_size(16)));
+typedef long long uv2di_t __attribute__((vector_size(16), may_alias, aligned(1)));
+
+__attribute__((target("sse2,pclmul")))
+static inline v2di_t crc32_fold(v2di_t x, v2di_t k)
+{
+	return __builtin_ia32_pclmulqdq128(x, k, 0x00)
+		^ __builtin_ia32_pclmulqdq128(x, k, 0x11);
+}
+
+__attribute__((target("sse2,pclmul")))
+static efi_u32_t pclmul_crc32(efi_u32_t crc, const unsigned char *p, size_t len)
+{
+	/* x^(4*128+32) and x^(4*128-32) mod P, then the same for 128 */
+	const v2di_t k1k2 = { 0x154442bd4, 0x1c6e41596 };
+	const v2di_t k3k4 = { 0x1751997d0, 0x0ccaa009e };
+	const v2di_t k5 = { 0x163cd6124, 0 };
+	/* P and the Barrett constant floor(x^64 / P), bit reflected */
+	const v2di_t poly = { 0x1db710641, 0x1f7011641 };
+	const v2di_t mask32 = { 0xffffffff, 0 };
+	v2di_t x1, x2, x3, x4;
+
+	x1 = ((const uv2di_t *) p)[0] ^ (v2di_t) { crc, 0 };
+	x2 = ((const uv2di_t *) p)[1];
+	x3 = ((const uv2di_t *) p)[2];
+	x4 = ((const uv2di_t *) p)[3];
+
+	for (p += 64, len -= 64; len >= 64; p += 64, len -= 64) {
+		x1 = crc32_fold(x1, k1k2) ^ ((const uv2di_t *) p)[0];
+		x2 = crc32_fold(x2, k1k2) ^ ((const uv2di_t *) p)[1];
+		x3 = crc32_fold(x3, k1k2) ^ ((const uv2di_t *) p)[2];
+		x4 = crc32_fold(x4, k1k2) ^ ((const uv2di_t *) p)[3];
+	}
+
+	x1 = crc32_fold(x1, k3k4) ^ x2;
+	x1 = crc32_fold(x1, k3k4) ^ x3;
+	x1 = crc32_fold(x1, k3k4) ^ x4;
+	for (; len >= 16; p += 16, len -= 16)
+		x1 = crc32_fold(x1, k3k4) ^ *(const uv2di_t *) p;
+
+	/* 128 to 64 bits, then to 32 bits */
+	x1 = __builtin_ia32_pclmulqdq128(k3k4, x1, 0x01)
+		^ __builtin_ia32_psrldqi128(x1, 64);
+	x2 = __builtin_ia32_psrldqi128(x1, 32);
+	x1 = __builtin_ia32_pclmulqdq128(x1 & mask32, k5, 0x00) ^ x2;
+
+	/* Barrett reduction */
+	x2 = x1;
+	x1 = __builtin_ia32_pclmulqdq128(x1 & mask32, poly, 0x10);
+	x1 = __builtin_ia32_pclmulqdq128(x1 & mask32, poly, 0x00) ^ x2;
+	return x1[0] >> 32;
+}
+
+crc32_kernel_t simd_crc32_init(void)
+{
+	if (efi_cpu_has(EFI_CPU_SSE2 | EFI_CPU_PCLMUL))
+		return pclmul_crc32;
+	return NULL;
+}
@@ -0,0 +1,216 @@
+/*
+ * SMBIOS structure index
+ */
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+/*
+ * Structures are sorted by type, type_first[t] is the first one of type t.
+ * Handles are looked up through a hash table of structure index + 1.
+ */
+static efi_smbios_structure_t *structures;
+static efi_size_t num_structures;
+static efi_u32_t type_first[257];
+static char **strings;
+static efi_u32_t *handle_slots;
+static efi_size_t handle_mask;
+static efi_u16_t version;
+static efi_status_t init_status = EFI_NOT_STARTED;
+
+static efi_u8_t checksum(void *data, efi_size_t len)
+{
+	efi_u8_t sum = 0;
+
+	for (efi_size_t i = 0; i < len; ++i)
+		sum += ((efi_u8_t *) data)[i];
+	return sum;
+}
+
+/* Find the structure table through the entry point */
+static efi_status_t find_table(efi_u8_t **table, efi_size_t *len, efi_size_t *max_count)
+{
+	void *entry = efi_smbios_entry_point();
+
+	if (!entry)
+		return EFI_NOT_FOUND;
+
+	if (!memcmp(entry, "_SM3_", 5)) {
+		efi_smbios3_entry_point_t *ep = entry;
+		if (ep->length < sizeof(*ep) || checksum(ep, ep->length))
+			return EFI_CRC_ERROR;
+		if (ep->table_address != (efi_uptr_t) ep->table_address)
+			return EFI_UNSUPPORTED;
+		*table = (efi_u8_t *) (efi_uptr_t) ep->table_address;
+		*len = ep->table_max_size;
+		*max_count = (efi_size_t) -1;
+		version = ep->major_version << 8 | ep->minor_version;
+	} else if (!memcmp(entry, "_SM_", 4)) {
+		efi_smbios_entry_point_t *ep = entry;
+		if (ep->length < sizeof(*ep) || checksum(ep, ep->length)
+				|| memcmp(ep->intermediate_anchor, "_DMI_", 5)
+				|| checksum(ep->intermediate_anchor, 15))
+			return EFI_CRC_ERROR;
+		*table = (efi_u8_t *) (efi_uptr_t) ep->table_address;
+		*len = ep->table_length;
+		*max_count = ep->num_structures;
+		version = ep->major_version << 8 | ep->minor_version;
+	} else {
+		return EFI_CRC_ERROR;
+	}
+	return EFI_SUCCESS;
+}
+
+/*
+ * Walk the structures in table, calling visit on each with its strings
+ * Returns how many there were
+ */
+static efi_size_t walk(efi_u8_t *table, efi_size_t len, efi_size_t max_count,
+	void (*visit)(efi_smbios_header_t *header, char *str, efi_size_t num_strings))
+{
+	efi_u8_t *pos = table, *end = table + len;
+	efi_size_t count = 0;
+
+	while (count < max_count && end - pos >= (efi_ssize_t) sizeof(efi_smbios_header_t)) {
+		efi_smbios_header_t *header = (efi_smbios_header_t *) pos;
+		efi_size_t num_strings = 0;
+		char *str;
+
+		if (header->length < sizeof(*header) || header->length > (efi_size_t) (end - pos))
+			break;
+
+		/* Strings follow the formatted area, an empty one ends the set */
+		str = (char *) pos + header->length;
+		pos = (efi_u8_t *) str;
+		while (pos < end && *pos) {
+			while (pos < end && *pos)
+				++pos;
+			++pos;
+			++num_strings;
+		}
+		/* Without strings the set is still two NULs long */
+		pos += num_strings ? 1 : 2;
+		if (pos > end)
+			break;
+
+		if (visit)
+			visit(header, str, num_strings);
+		++count;
+		if (header->type == EFI_SMBIOS_TYPE_END)
+			break;
+	}
+	return count;
+}
+
+static efi_size_t total_strings, next_string;
+
+static void count_strings(efi_smbios_header_t *header, char *str, efi_size_t num_strings)
+{
+	(void) str;
+	++type_first[header->type + 1];
+	total_strings += num_strings;
+}
+
+static void add_structure(efi_smbios_header_t *header, char *str, efi_size_t num_strings)
+{
+	efi_smbios_structure_t *s;
+	efi_size_t i;
+
+	/* type_first[t] is used as the fill position of type t */
+	s = &structures[type_first[header->type]++];
+	s->header = header;
+	s->strings = strings + next_string;
+	s->num_strings = num_strings;
+	for (; num_strings--; str += strlen(str) + 1)
+		strings[next_string++] = str;
+
+	for (i = header->handle * 0x9e3779b1u & handle_mask; handle_slots[i];
+			i = (i + 1) & handle_mask)
+		;
+	handle_slots[i] = s - structures + 1;
+}
+
+efi_status_t efi_smbios_init(void)
+{
+	efi_u8_t *table;
+	efi_size_t len, max_count, size;
+
+	if (init_status != EFI_NOT_STARTED)
+		return init_status;
+
+	init_status = find_table(&table, &len, &max_count);
+	if (EFI_ERROR(init_status))
+		return init_status;
+
+	/* Count first, then sort by type with the counts as bucket offsets */
+	num_structures = walk(table, len, max_count, count_strings);
+	for (efi_size_t t = 0; t < 256; ++t)
+		type_first[t + 1] += type_first[t];
+
+	structures = efi_alloc((num_structures + 1) * sizeof(*structures));
+	strings = efi_alloc((total_strings + 1) * sizeof(*strings));
+	for (size = 16; size < num_structures * 2; size *= 2)
+		;
+	handle_slots = efi_alloc(size * sizeof(*handle_slots));
+	memset(handle_slots, 0, size * sizeof(*handle_slots));
+	handle_mask = size - 1;
+
+	walk(table, len, max_count, add_structure);
+
+	/* Filling moved every bucket start onto the next, move them back */
+	for (efi_size_t t = 256; t > 0; --t)
+		type_first[t] = type_first[t - 1];
+	type_first[0] = 0;
+	return init_status;
+}
+
+void smbios_reset(void)
+{
+	structures = NULL;
+	num_structures = 0;
+	memset(type_first, 0, sizeof(type_first));
+	strings = NULL;
+	total_strings = 0;
+	next_string = 0;
+	handle_slots = NULL;
+	handle_mask = 0;
+	version = 0;
+	init_status = EFI_NOT_STARTED;
+}
+
+efi_u16_t efi_smbios_version(void)
+{
+	return efi_smbios_init() == EFI_SUCCESS ? version : 0;
+}
+
+efi_smbios_structure_t *efi_smbios_by_type(efi_u8_t type, efi_size_t *count)
+{
+	if (EFI_ERROR(efi_smbios_init())) {
+		*count = 0;
+		return NULL;
+	}
+
+	*count = type_first[type + 1] - type_first[type];
+	return *count ? &structures[type_first[type]] : NULL;
+}
+
+efi_smbios_structure_t *efi_smbios_by_handle(efi_u16_t handle)
+{
+	efi_u32_t idx;
+
+	if (EFI_ERROR(efi_smbios_init()))
+		return NULL;
+
+	for (efi_size_t i = handle * 0x9e3779b1u & handle_mask; (idx = handle_slots[i]);
+			i = (i + 1) & handle_mask)
+		if (structures[idx - 1].header->handle == handle)
+			return &structures[idx - 1];
+	return NULL;
+}
+
+char *efi_smbios_string(efi_smbios_structure_t *s, efi_u8_t n)
+{
+	if (n == 0 || n > s->num_strings)
+		return NULL;
+	return s->strings[n - 1];
+}
@@ -1,73 +1,314 @@
 /*
  * Standard string functions
+ *
+ * Copies and fills move whole words once the destination is aligned. Longer
+ * runs go to the SSE2/AVX2 kernels when usable, and the longest ones to rep
+ * movsb/stosb on CPUs with enhanced or fast short rep string operations.
+ * Compares use the vector kernels the same way.
+ *
+ * String scans read aligned words and look for a terminator in all bytes
+ * (or 16-bit lanes) at once. An aligned word never crosses a page boundary,
+ * so reading a little past the terminator or before the start is harmless.
  */
-#include <stddef.h>
+#include <efi.h>
+#include <efiutil.h>
+#include "private.h"
+
+#define WORD_SIZE sizeof(size_t)
+
+/* Word access that may alias anything, the unaligned one may be misaligned */
+typedef size_t __attribute__((may_alias)) word_t;
+typedef size_t __attribute__((may_alias, aligned(1))) uword_t;
+
+/* Every byte or 16-bit lane of a word set to 1 and to its top bit set */
+#define ONES8   (SIZE_MAX / 0xff)
+#define HIGHS8  (ONES8 << 7)
+#define ONES16  (SIZE_MAX / 0xffff)
+#define HIGHS16 (ONES16 << 15)
+
+/*
+ * Non-zero if any byte (or lane) of w is zero, the lowest set bit always
+ * marks the first zero byte (or lane)
+ */
+#define has_zero8(w)  (((w) - ONES8) & ~(w) & HIGHS8)
+#define has_zero16(w) (((w) - ONES16) & ~(w) & HIGHS16)
+
+/* Index of the lowest set bit */
+#define lowest_bit(w) ((size_t) __builtin_ctzll(w))
+
+/* Copies and fills at least this long use rep movsb/stosb */
+static size_t rep_threshold = SIZE_MAX;
+
+/* Operations at least this long use the vector kernels */
+static size_t bulk_threshold = SIZE_MAX;
+static const struct bulk_ops *bulk;
+
+void string_init(void)
+{
+  rep_threshold = SIZE_MAX;
+  bulk_threshold = SIZE_MAX;
+
+  bulk = simd_init();
+  if (bulk) {
+    /* Vector loops win until the startup cost of rep movsb pays off */
+    bulk_threshold = 64;
+    if (efi_cpu_has(EFI_CPU_ERMS))
+      rep_threshold = 2048;
+  } else if (efi_cpu_has(EFI_CPU_FSRM)) {
+    rep_threshold = 64;
+  } else if (efi_cpu_has(EFI_CPU_ERMS)) {
+    rep_threshold = 512;
+  }
+}
+
+static void rep_movsb(void *dest, const void *src, size_t n)
+{
+  asm volatile ("rep movsb"
+    : "+D" (dest), "+S" (src), "+c" (n)
+    :: "memory");
+}
+
+static void rep_stosb(void *s, int c, size_t n)
+{
+  asm volatile ("rep stosb"
+    : "+D" (s), "+c" (n)
+    : "a" (c)
+    : "memory");
+}
 
 void *memset(void *s, int c, size_t n)
 {
-  char *p;
+  unsigned char *p;
+  size_t pattern;
 
-  for (p = s; n; --n)
+  if (n >= rep_threshold) {
+    rep_stosb(s, c, n);
+    return s;
+  }
+  if (n >= bulk_threshold) {
+    bulk->fill(s, c, n);
+    return s;
+  }
+
+  p = s;
+  if (n >= WORD_SIZE) {
+    /* Align the head, then store whole words */
+    for (; (uintptr_t) p & (WORD_SIZE - 1); --n)
+      *p++ = c;
+
+    pattern = (unsigned char) c * (SIZE_MAX / 0xff);
+    for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, p += 4 * WORD_SIZE) {
+      ((word_t *) p)[0] = pattern;
+      ((word_t *) p)[1] = pattern;
+      ((word_t *) p)[2] = pattern;
+      ((word_t *) p)[3] = pattern;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE, p += WORD_SIZE)
+      *(word_t *) p = pattern;
+  }
+
+  /* Tail */
+  for (; n; --n)
     *p++ = c;
 
   return s;
 }
 
-void *memmove(void *dest, void *src, size_t n)
+/* Forward copy, also safe for overlapping regions when dest is below src */
+static void copy_forward(unsigned char *d, const unsigned char *s, size_t n)
 {
-  char *d, *s;
-
-  d = dest;
-  s = src;
+  if (n >= rep_threshold) {
+    rep_movsb(d, s, n);
+    return;
+  }
+  if (n >= bulk_threshold) {
+    bulk->copy(d, s, n);
+    return;
+  }
 
-  if (s < d) {
-    d += n;
-    s += n;
-    while (n--)
-      *--d = *--s;
-  } else {
-    while (n--)
+  if (n >= WORD_SIZE) {
+    /* Align the destination head, the source may stay misaligned */
+    for (; (uintptr_t) d & (WORD_SIZE - 1); --n)
       *d++ = *s++;
+
+    for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE) {
+      size_t w0 = ((const uword_t *) s)[0];
+      size_t w1 = ((const uword_t *) s)[1];
+      size_t w2 = ((const uword_t *) s)[2];
+      size_t w3 = ((const uword_t *) s)[3];
+      ((word_t *) d)[0] = w0;
+      ((word_t *) d)[1] = w1;
+      ((word_t *) d)[2] = w2;
+      ((word_t *) d)[3] = w3;
+      d += 4 * WORD_SIZE;
+      s += 4 * WORD_SIZE;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE, d += WORD_SIZE, s += WORD_SIZE)
+      *(word_t *) d = *(const uword_t *) s;
   }
 
-  return dest;
+  /* Tail */
+  for (; n; --n)
+    *d++ = *s++;
 }
 
-void *memcpy(void *dest, void *src, size_t n)
+/* Backward copy for overlapping regions with dest above src */
+static void copy_backward(unsigned char *d, const unsigned char *s, size_t n)
 {
-  char *d, *s;
+  d += n;
+  s += n;
 
-  d = dest;
-  s = src;
+  if (n >= WORD_SIZE) {
+    /* Align the end of the destination */
+    for (; (uintptr_t) d & (WORD_SIZE - 1); --n)
+      *--d = *--s;
 
-  while (n--)
-    *d++ = *s++;
+    for (; n >= WORD_SIZE; n -= WORD_SIZE) {
+      d -= WORD_SIZE;
+      s -= WORD_SIZE;
+      *(word_t *) d = *(const uword_t *) s;
+    }
+  }
+
+  /* Head */
+  for (; n; --n)
+    *--d = *--s;
+}
+
+void *memmove(void *dest, const void *src, size_t n)
+{
+  if ((uintptr_t) dest - (uintptr_t) src >= n)
+    copy_forward(dest, src, n);
+  else
+    copy_backward(dest, src, n);
 
   return dest;
 }
 
+void *memcpy(void *dest, const void *src, size_t n)
+{
+  copy_forward(dest, src, n);
+  return dest;
+}
+
 int memcmp(const void *s1, const void *s2, size_t n)
 {
-  const char *p1, *p2;
+  const unsigned char *p1, *p2;
 
-  if (n) {
-    p1 = s1;
-    p2 = s2;
-    do {
-      if (*p1++ != *p2++)
-        return *--p1 - *--p2;
-    } while (--n);
-  }
+  if (n >= bulk_threshold)
+    return bulk->cmp(s1, s2, n);
+
+  p1 = s1;
+  p2 = s2;
+
+  /* Skip over equal words, only bytes inside both regions are read */
+  for (; n >= WORD_SIZE; n -= WORD_SIZE, p1 += WORD_SIZE, p2 += WORD_SIZE)
+    if (*(const uword_t *) p1 != *(const uword_t *) p2)
+      break;
+
+  for (; n; --n, ++p1, ++p2)
+    if (*p1 != *p2)
+      return *p1 - *p2;
 
   return 0;
 }
 
 size_t strlen(const char *s)
 {
-  const char *p;
+  const word_t *p;
+  size_t off, w;
+
+  /* Read aligned words, pretend the bytes before s are non-zero */
+  off = (uintptr_t) s & (WORD_SIZE - 1);
+  p = (const word_t *) (s - off);
+  w = *p;
+  if (off)
+    w |= ((size_t) 1 << (8 * off)) - 1;
+
+  while (!has_zero8(w))
+    w = *++p;
+
+  return (const char *) p + lowest_bit(has_zero8(w)) / 8 - s;
+}
+
+/* Length of a UCS-2 string, stopping at max characters */
+static efi_size_t ucs2_len(efi_ch16_t *str, efi_size_t max)
+{
+  const word_t *p;
+  efi_size_t off, len;
+  size_t w;
+
+  /* Strings from packed structures might be misaligned */
+  if ((uintptr_t) str & 1) {
+    for (len = 0; len < max && str[len]; ++len)
+      ;
+    return len;
+  }
+
+  /* Read aligned words, pretend the lanes before str are non-zero */
+  off = (uintptr_t) str & (WORD_SIZE - 1);
+  p = (const word_t *) ((uintptr_t) str - off);
+  w = *p;
+  if (off)
+    w |= ((size_t) 1 << (8 * off)) - 1;
+
+  for (len = (WORD_SIZE - off) / 2; !has_zero16(w); len += WORD_SIZE / 2) {
+    if (len >= max)
+      return max;
+    w = *++p;
+  }
+
+  len = ((uintptr_t) p + lowest_bit(has_zero16(w)) / 8 - (uintptr_t) str) / 2;
+  return len < max ? len : max;
+}
+
+efi_size_t efi_strlen(efi_ch16_t *str)
+{
+  return ucs2_len(str, SIZE_MAX);
+}
+
+efi_size_t efi_strnlen(efi_ch16_t *str, efi_size_t max)
+{
+  return ucs2_len(str, max);
+}
+
+efi_size_t efi_strsize(efi_ch16_t *str)
+{
+  return (efi_strlen(str) + 1) * sizeof(efi_ch16_t);
+}
+
+/* Compare at most n characters of two UCS-2 strings */
+static efi_ssize_t ucs2_cmp(efi_ch16_t *str1, efi_ch16_t *str2, efi_size_t n)
+{
+  /* Whole words can be compared when both strings share the alignment */
+  if ((((uintptr_t) str1 ^ (uintptr_t) str2) & (WORD_SIZE - 1)) == 0
+      && !((uintptr_t) str1 & 1)) {
+    for (; n && ((uintptr_t) str1 & (WORD_SIZE - 1)); --n, ++str1, ++str2)
+      if (*str1 != *str2 || !*str1)
+        return (efi_ssize_t) *str1 - *str2;
+
+    for (; n >= WORD_SIZE / 2; n -= WORD_SIZE / 2) {
+      size_t w1 = *(const word_t *) str1;
+      if (w1 != *(const word_t *) str2 || has_zero16(w1))
+        break;
+      str1 += WORD_SIZE / 2;
+      str2 += WORD_SIZE / 2;
+    }
+  }
+
+  for (; n; --n, ++str1, ++str2)
+    if (*str1 != *str2 || !*str1)
+      return (efi_ssize_t) *str1 - *str2;
+
+  return 0;
+}
 
-  for (p = s; *p; ++p)
-    ;
+efi_ssize_t efi_strcmp(efi_ch16_t *str1, efi_ch16_t *str2)
+{
+  return ucs2_cmp(str1, str2, SIZE_MAX);
+}
 
-  return p - s;
+efi_ssize_t efi_strncmp(efi_ch16_t *str1, efi_ch16_t *str2, efi_size_t n)
+{
+  return ucs2_cmp(str1, str2, n);
 }
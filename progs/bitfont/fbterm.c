@@ -36,10 +36,7 @@ void fb_putchar(struct fbinfo *fb, char ch)
 	uint8_t line, bit;
 
 	if (fb_row >= fb->y_limit / fb_font->lines) {
-		/*
-		 * Scroll one line
-		 * TODO: replace slow memmove with optimized assembly
-		 */
+		/* Scroll one line */
 		memmove(
 			(void *) fb->base,
 			(void *) fb->base + fb->linewidth * fb_font->lines,
@@ -1,6 +1,32 @@
 #include <efi.h>
 #include <efiutil.h>
 
+// Print the boot log left behind by an earlier libefi program
+static void dump_boot_log(void)
+{
+  efi_size_t size = 0;
+  efi_boot_log_t *log = NULL;
+  efi_status_t status;
+
+  status = efi_rt->get_variable(EFI_BOOT_LOG_VARIABLE,
+    &(efi_guid_t) EFI_BOOT_LOG_GUID, NULL, &size, NULL);
+  if (status != EFI_BUFFER_TOO_SMALL)
+    return;
+  log = efi_alloc(size);
+  status = efi_rt->get_variable(EFI_BOOT_LOG_VARIABLE,
+    &(efi_guid_t) EFI_BOOT_LOG_GUID, NULL, &size, log);
+  if (EFI_ERROR(status) || log->signature != EFI_BOOT_LOG_SIGNATURE)
+    goto done;
+
+  efi_print(L"Boot log:\n");
+  for (efi_boot_log_record_t *rec = efi_boot_log_next(log, NULL); rec;
+      rec = efi_boot_log_next(log, rec))
+    efi_print(L"[%" EFI_PRIu64 "] %a\n", rec->timestamp, rec->text);
+
+done:
+  efi_free(log);
+}
+
 efi_status_t efiapi efi_main(efi_handle_t image_handle, efi_system_table_t *system_table)
 {
   efi_init(image_handle, system_table);
@@ -9,7 +35,6 @@ efi_status_t efiapi efi_main(efi_handle_t image_handle, efi_system_table_t *syst
   efi_size_t varcnt = 0;
 
   // Empty string starts a search
-  efi_size_t old_name_size;
   efi_size_t var_name_size = sizeof(efi_ch16_t);
   efi_ch16_t *var_name = efi_alloc(var_name_size);
   var_name[0] = 0;
@@ -20,10 +45,9 @@ efi_status_t efiapi efi_main(efi_handle_t image_handle, efi_system_table_t *syst
   for (;;) {
     // Get name and GUID for this variable
 retry:
-    old_name_size = var_name_size;
     status = efi_rt->get_next_variable_name(&var_name_size, var_name, &vendor_guid);
     if (status == EFI_BUFFER_TOO_SMALL) { // We need a bigger buffer
-      var_name = efi_realloc(var_name, old_name_size, var_name_size);
+      var_name = efi_resize(var_name, var_name_size);
       goto retry;
     } else if (status == EFI_NOT_FOUND) { // End of variables
       efi_free(var_name);
@@ -31,10 +55,11 @@ retry:
     } else if (EFI_ERROR(status)) { // Some other error
       return status;
     }
-    efi_print(L"%g %s\n", vendor_guid, var_name);
+    efi_print(L"%g %s\n", &vendor_guid, var_name);
     ++varcnt;
   }
 
-  efi_print(L"# of variables printed: %zd\n", varcnt);
+  EFI_PRINT(L"# of variables printed: ", varcnt, L"\n");
+  dump_boot_log();
   return EFI_SUCCESS;
 }
@@ -9,33 +9,42 @@
 #define PAGE_SIZE 4096
 #define PAGE_COUNT(x) ((x + PAGE_SIZE - 1) / PAGE_SIZE)
 
-static efi_status_t alloc_aligned(efi_size_t alingment, efi_size_t bytes, void **buffer)
+/* UEFI memory map, the buffer is kept so it can be fetched again */
+struct uefi_mmap {
+  void        *buf;
+  efi_size_t  cap;
+  efi_size_t  size;
+  efi_size_t  key;
+  efi_size_t  desc_size;
+  efi_u32_t   desc_ver;
+};
+
+/*
+ * Fetch the UEFI memory map, growing the buffer only if can_alloc is set.
+ * After a failed ExitBootServices nothing but get_memory_map may be called.
+ */
+static efi_status_t get_mmap(struct uefi_mmap *mmap, efi_bool_t can_alloc)
 {
   efi_status_t status;
 
-  status = efi_bs->allocate_pages(
-    EFI_ALLOCATE_ANY_PAGES,
-    EFI_LOADER_CODE,
-    PAGE_COUNT(alingment + bytes),
-    (efi_physical_address_t *) buffer);
-
-  if (EFI_ERROR(status))
-    return status;
-
-  *buffer += alingment - (efi_size_t) *buffer % alingment;
-  return status;
+  for (;;) {
+    mmap->size = mmap->cap;
+    status = efi_bs->get_memory_map(
+      &mmap->size,
+      mmap->buf,
+      &mmap->key,
+      &mmap->desc_size,
+      &mmap->desc_ver);
+    if (status != EFI_BUFFER_TOO_SMALL || !can_alloc)
+      return status;
+    /* Leave room for the descriptors the allocation itself may add */
+    mmap->cap = mmap->size + 4 * mmap->desc_size;
+    mmap->buf = efi_scratch_alloc(mmap->cap);
+  }
 }
 
-static efi_status_t convert_mmap(struct boot_params *boot_params, efi_size_t *map_key)
+static efi_status_t convert_mmap(struct boot_params *boot_params, struct uefi_mmap *mmap)
 {
-  efi_status_t status;
-  efi_loaded_image_protocol_t *loaded_image;
-
-  /* UEFI memory map */
-  void    *mmap;
-  efi_size_t  mmap_size;
-  efi_size_t  desc_size;
-  efi_u32_t   desc_ver;
   efi_memory_descriptor_t *mmap_ent;
 
   /* E820 memory map */
@@ -43,46 +52,18 @@ static efi_status_t convert_mmap(struct boot_params *boot_params, efi_size_t *ma
   efi_size_t  e820_entries;
   struct boot_e820_entry  *e820_cur;
 
-  status = efi_bs->handle_protocol(
-    efi_image_handle,
-    &(efi_guid_t) EFI_LOADED_IMAGE_PROTOCOL_GUID,
-    (void **) &loaded_image);
-  if (EFI_ERROR(status))
-    return status;
-
-  mmap = NULL;
-  mmap_size = 0;
-
-retry:
-  status = efi_bs->get_memory_map(
-    &mmap_size,
-    mmap,
-    map_key,
-    &desc_size,
-    &desc_ver);
-
-  if (status == EFI_BUFFER_TOO_SMALL) {
-    mmap = efi_alloc(mmap_size);
-    goto retry;
-  }
-
-  if (EFI_ERROR(status)) /* Failed to get UEFI memory map */
-    return status;
-
   /* Allocate an E820 memory map with the same number of entries */
   e820_cur = boot_params->e820_table;
-  e820_entries = mmap_size / desc_size;
+  e820_entries = mmap->size / mmap->desc_size;
   /* Make sure this firmware's memory map is compatible with the kernel */
-  if (e820_entries > E820_MAX_ENTRIES_ZEROPAGE) {
-    efi_free(mmap);
+  if (e820_entries > E820_MAX_ENTRIES_ZEROPAGE)
     return EFI_UNSUPPORTED;
-  }
   boot_params->e820_entries = e820_entries;
 
   /* Convert UEFI memory map to E820 */
   e820_last_type = 0;
-  for (mmap_ent = mmap; (void *) mmap_ent < mmap + mmap_size;
-        mmap_ent = (void *) mmap_ent + desc_size) {
+  for (mmap_ent = mmap->buf; (void *) mmap_ent < mmap->buf + mmap->size;
+        mmap_ent = (void *) mmap_ent + mmap->desc_size) {
     e820_cur->addr = mmap_ent->start;
     e820_cur->size = mmap_ent->number_of_pages * PAGE_SIZE;
 
@@ -123,7 +104,7 @@ retry:
 
   /* NOTE: the UEFI memmap cannot ever be freed otherwise calling
      ExitBootServices is not allowed */
-  return status;
+  return EFI_SUCCESS;
 }
 
 static efi_status_t setup_video(struct boot_params *boot_params)
@@ -229,18 +210,18 @@ static efi_status_t get_file_size(efi_file_protocol_t *file, efi_size_t *file_si
   efi_status_t  status;
   efi_file_info_t *file_info;
 
-  status = efi_get_file_info(file, &file_info);
+  status = efi_scratch_get_file_info(file, &file_info);
   if (EFI_ERROR(status))
     return status;
 
   *file_size = file_info->file_size;
-  efi_free(file_info);
   return status;
 }
 
 static efi_status_t boot_linux(efi_ch16_t *kernel_path, efi_ch16_t *initrd_path, char *cmdline)
 {
   efi_status_t    status;
+  efi_scratch_mark_t  scratch;
 
   efi_size_t    cmdline_size;
   struct boot_params  *boot_params;
@@ -249,13 +230,17 @@ static efi_status_t boot_linux(efi_ch16_t *kernel_path, efi_ch16_t *initrd_path,
   efi_file_protocol_t   *root_dir;
 
   efi_file_protocol_t *kernel_file;
+  efi_pages_t   kernel_pages;
   void      *kernel_base;
 
   efi_file_protocol_t *initrd_file;
   efi_size_t    initrd_size;
   void      *initrd_base;
 
-  efi_size_t    map_key;
+  struct uefi_mmap  mmap = { 0 };
+
+  /* Temporaries of the load phase all come from the scratch arena */
+  scratch = efi_scratch_mark();
 
   /* Allocate boot params + cmdline buffer */
   cmdline_size = strlen(cmdline) + 1;
@@ -265,8 +250,8 @@ static efi_status_t boot_linux(efi_ch16_t *kernel_path, efi_ch16_t *initrd_path,
     PAGE_COUNT(sizeof(struct boot_params) + cmdline_size),
     (efi_physical_address_t *) &boot_params);
   if (EFI_ERROR(status))
-    return status;
-  efi_print(L"Boot params at %p\n", boot_params);
+    goto err_release_scratch;
+  EFI_LOG_DEBUG(L"Boot params at %p\n", boot_params);
   /* Zero boot params */
   memset(boot_params, 0, sizeof(struct boot_params));
   /* Copy cmdline */
@@ -311,14 +296,17 @@ static efi_status_t boot_linux(efi_ch16_t *kernel_path, efi_ch16_t *initrd_path,
   }
 
   /* Allocate buffer for the kernel image */
-  efi_print(L"Kernel alingment: %#" EFI_PRIx32 "\n", boot_params->hdr.kernel_alignment);
-  status = alloc_aligned(
+  EFI_LOG_DEBUG(L"Kernel alignment: %#" EFI_PRIx32 "\n", boot_params->hdr.kernel_alignment);
+  status = efi_alloc_pages(
+    EFI_LOADER_CODE,
+    0,
     boot_params->hdr.kernel_alignment,
     boot_params->hdr.init_size,
-    &kernel_base);
+    &kernel_pages);
   if (EFI_ERROR(status))
     goto err_close_kernel;
-  efi_print(L"Kernel will be loaded at: %p\n", kernel_base);
+  kernel_base = (void *) kernel_pages.base;
+  EFI_LOG_DEBUG(L"Kernel will be loaded at: %p\n", kernel_base);
 
   /* Load kernel */
   status = read_file(kernel_file,
@@ -373,28 +361,48 @@ static efi_status_t boot_linux(efi_ch16_t *kernel_path, efi_ch16_t *initrd_path,
   boot_params->hdr.ramdisk_size = (efi_u64_t) initrd_size;
   boot_params->ext_ramdisk_size = (efi_u64_t) initrd_size >> 32;
 
-  /* Find ACPI RSDP */
-  for (size_t i = 0; i < efi_st->cnt_config_entries; ++i)
-    if (!memcmp(&efi_st->config_entries[i].vendor_guid,
-        &(efi_guid_t) EFI_ACPI_TABLE_GUID,
-        sizeof(efi_guid_t)))
-      boot_params->acpi_rsdp_addr =
-        (efi_size_t) efi_st->config_entries[i].vendor_table;
+  /* Find ACPI RSDP, indexing the tables now keeps them in reach after exit */
+  if (EFI_ERROR(efi_acpi_init()))
+    EFI_LOG_WARN(L"ACPI tables missing or corrupt\n");
+  boot_params->acpi_rsdp_addr = (efi_size_t) efi_acpi_rsdp();
 
   /* Find the framebuffer */
   status = setup_video(boot_params);
   if (EFI_ERROR(status))
-    efi_print(L"WARN: graphics setup failed!\n");
+    EFI_LOG_WARN(L"graphics setup failed\n");
+
+  /* Leave a copy of the log for the next stage */
+  if (EFI_ERROR(efi_boot_log_checkpoint(EFI_BOOT_LOG_VARIABLE_MAX)))
+    EFI_LOG_WARN(L"boot log checkpoint failed\n");
 
   /* Convert the UEFI memory map to E820 for the kernel */
-  status = convert_mmap(boot_params, &map_key);
+  status = get_mmap(&mmap, true);
   if (EFI_ERROR(status))
-    return status;
-  /* Get rid of boot services */
-  status = efi_bs->exit_boot_services(efi_image_handle, map_key);
+    goto err_free_loaded;
+  status = convert_mmap(boot_params, &mmap);
+  if (EFI_ERROR(status))
+    goto err_free_loaded;
+
+  /*
+   * Get rid of boot services. If the map changed in the meantime this fails
+   * with EFI_INVALID_PARAMETER, and only get_memory_map and
+   * exit_boot_services may be called afterwards, so retry with a fresh map.
+   */
+  status = efi_exit_boot_services(mmap.key);
+  if (status == EFI_INVALID_PARAMETER) {
+    status = get_mmap(&mmap, false);
+    if (!EFI_ERROR(status))
+      status = convert_mmap(boot_params, &mmap);
+    if (!EFI_ERROR(status))
+      status = efi_exit_boot_services(mmap.key);
+  }
+  /* Boot services may be half gone, so nothing can be cleaned up */
   if (EFI_ERROR(status))
     return status;
 
+  /* Only reaches sinks that work without boot services */
+  EFI_LOG_INFO(L"Jumping to kernel at %p\n", kernel_base + 0x200);
+
   /* Jump to the kernel's entry point */
   asm volatile (
     "cli\n"
@@ -405,14 +413,20 @@ static efi_status_t boot_linux(efi_ch16_t *kernel_path, efi_ch16_t *initrd_path,
     "g" (boot_params)
     : "rax", "rsi");
 
+  /* The files are closed by now, only the memory is left to free */
+err_free_loaded:
+  efi_bs->free_pages((efi_physical_address_t) initrd_base,
+    PAGE_COUNT(initrd_size));
+  efi_free_pages(&kernel_pages);
+  goto err_free_boot_params;
+
 err_free_initrd:
   efi_bs->free_pages((efi_physical_address_t) initrd_base,
     PAGE_COUNT(initrd_size));
 err_close_initrd:
   initrd_file->close(initrd_file);
 err_free_kernel:
-  efi_bs->free_pages((efi_physical_address_t) kernel_base,
-    PAGE_COUNT(boot_params->hdr.init_size));
+  efi_free_pages(&kernel_pages);
 err_close_kernel:
   kernel_file->close(kernel_file);
 err_close_rootdir:
@@ -421,6 +435,8 @@ err_free_boot_params:
   efi_bs->free_pages(
     (efi_physical_address_t) boot_params,
     PAGE_COUNT(sizeof(struct boot_params) + cmdline_size));
+err_release_scratch:
+  efi_scratch_release(scratch);
   return status;
 }
 
@@ -431,6 +447,14 @@ efi_main(efi_handle_t image_handle, efi_system_table_t *system_table)
   efi_status_t status;
 
   efi_init(image_handle, system_table);
+
+  /* Keep logging to QEMU's debug console after exit_boot_services */
+  static efi_log_sink_t debugcon;
+  if (efi_debugcon_sink_init(&debugcon))
+    efi_log_attach(&debugcon);
+  /* Keep a log the kernel can find, and that survives a failed boot */
+  efi_boot_log_init(4 * EFI_PAGE_SIZE);
+
   efi_print(L"libefi loadlin %s\n", GIT_REV);
 
   status = boot_linux(
@@ -23,10 +23,18 @@ mmd -D skip -i $VMDIR/disk.img /EFI || true
 mmd -D skip -i $VMDIR/disk.img /EFI/BOOT || true
 mcopy -D overwrite -i $VMDIR/disk.img $1 ::/EFI/BOOT/BOOTX64.EFI
 
+# Output written to the debugcon port goes to $DEBUGCON if set
+if [ -n "$DEBUGCON" ]; then
+	set -- -debugcon file:$DEBUGCON -global isa-debugcon.iobase=0xe9
+else
+	set --
+fi
+
 qemu-system-x86_64 \
 	-M q35 \
 	-cpu qemu64 \
 	-m 128M \
 	-drive if=pflash,unit=0,format=raw,file=$CODE,readonly=on \
 	-drive if=pflash,unit=1,format=raw,file=$VMDIR/vars.fd \
-	-drive if=virtio,format=raw,file=$VMDIR/disk.img
+	-drive if=virtio,format=raw,file=$VMDIR/disk.img \
+	"$@"